@@ -0,0 +1,1097 @@
+/*
+    reliq - html searching tool
+    Copyright (C) 2020-2024 Dominik Stanisław Suchora <suchora.dominik7@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+#define __USE_XOPEN
+#define __USE_XOPEN_EXTENDED
+#define _XOPEN_SOURCE 600
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <regex.h>
+
+typedef unsigned char uchar;
+typedef unsigned short ushort;
+typedef unsigned int uint;
+typedef unsigned long int ulong;
+
+#include "flexarr.h"
+#include "scan.h"
+#include "dfa.h"
+
+/* Patterns are parsed with the same rules as glibc's regcomp() for
+   REG_EXTENDED and basic syntax, compiled to nfa and then fully
+   determinized. Everything that can't be expressed (back-references,
+   gnu operators, multibyte locales) or would grow too big is left
+   to regexec(), which is signaled by dfa_comp() returning NULL. */
+
+#define NFA_MAX 2048
+#define DFA_MAX 512
+#define REP_INF -1
+#define REP_MAX 255
+#define MUST_MAX 64
+
+#define D_ACCEPT 0x1
+#define D_ACCEPT_END 0x2 //accepts if input ends here
+#define D_DEAD 0x4
+
+enum {
+  T_SET,
+  T_EMPTY,
+  T_BOL,
+  T_EOL,
+  T_CAT,
+  T_ALT,
+  T_REP,
+  T_OPAQUE //escape that isn't supported, matching anything
+};
+
+struct tnode {
+  uchar type;
+  uint a; //left child or set of T_SET
+  uint b;
+  int min;
+  int max;
+};
+
+typedef struct {
+  uint64_t b[4];
+} charset;
+
+struct parser {
+  const uchar *src;
+  size_t pos;
+  size_t size;
+  int flags;
+  flexarr *tree; //struct tnode
+  flexarr *sets; //charset
+  uchar caret; //'^' is an anchor at this position in basic syntax
+  uchar opaque; //allow T_OPAQUE
+};
+
+enum {
+  N_SET,
+  N_SPLIT,
+  N_BOL,
+  N_EOL,
+  N_MATCH
+};
+
+struct nstate {
+  uchar type;
+  uint out;
+  uint out1; //second branch of N_SPLIT, set of N_SET
+};
+
+static inline void
+set_add(charset *s, const uchar c)
+{
+  s->b[c>>6] |= ((uint64_t)1)<<(c&63);
+}
+
+static inline uchar
+set_has(const charset *s, const uchar c)
+{
+  return (s->b[c>>6]>>(c&63))&1;
+}
+
+static int
+tnode_add(struct parser *p, const uchar type, const uint a, const uint b)
+{
+  struct tnode *n = flexarr_inc(p->tree);
+  n->type = type;
+  n->a = a;
+  n->b = b;
+  n->min = n->max = 0;
+  return p->tree->size-1;
+}
+
+static int
+set_node(struct parser *p, const charset *s)
+{
+  *(charset*)flexarr_inc(p->sets) = *s;
+  return tnode_add(p,T_SET,p->sets->size-1,0);
+}
+
+static int
+literal(struct parser *p, const uchar c)
+{
+  charset s = {{0}};
+  if (p->flags&REG_ICASE) {
+    const int l = tolower(c);
+    for (uint i = 0; i < 256; i++)
+      if (tolower(i) == l)
+        set_add(&s,i);
+  } else
+    set_add(&s,c);
+  return set_node(p,&s);
+}
+
+static inline uchar
+at_alt(const struct parser *p)
+{
+  if (p->flags&REG_EXTENDED)
+    return p->src[p->pos] == '|';
+  return p->src[p->pos] == '\\' && p->pos+1 < p->size && p->src[p->pos+1] == '|';
+}
+
+static inline uchar
+at_close(const struct parser *p)
+{
+  if (p->flags&REG_EXTENDED)
+    return p->src[p->pos] == ')';
+  return p->src[p->pos] == '\\' && p->pos+1 < p->size && p->src[p->pos+1] == ')';
+}
+
+static uchar
+class_add(charset *s, const uchar *name, const size_t namel)
+{
+  static const struct {
+    const char *name;
+    int (*func)(int);
+  } classes[] = {
+    {"alpha",isalpha},{"digit",isdigit},{"alnum",isalnum},
+    {"upper",isupper},{"lower",islower},{"space",isspace},
+    {"blank",isblank},{"punct",ispunct},{"print",isprint},
+    {"graph",isgraph},{"cntrl",iscntrl},{"xdigit",isxdigit}
+  };
+  for (size_t i = 0; i < sizeof(classes)/sizeof(classes[0]); i++) {
+    if (strlen(classes[i].name) != namel || memcmp(classes[i].name,name,namel) != 0)
+      continue;
+    for (uint j = 0; j < 256; j++)
+      if (classes[i].func(j))
+        set_add(s,j);
+    return 1;
+  }
+  return 0;
+}
+
+//let regcomp() decide for every byte, for brackets depending on locale
+static int
+bracket_oracle(const struct parser *p, const size_t start, const size_t end, charset *s)
+{
+  size_t len = end-start;
+  char *tmp = malloc(len+3);
+  tmp[0] = '^';
+  memcpy(tmp+1,p->src+start,len);
+  tmp[len+1] = '$';
+  tmp[len+2] = 0;
+
+  regex_t reg;
+  int r = regcomp(&reg,tmp,p->flags);
+  free(tmp);
+  if (r)
+    return -1;
+
+  memset(s,0,sizeof(*s));
+  for (uint i = 0; i < 256; i++) {
+    char c[2] = {i,0};
+    regmatch_t pmatch;
+    pmatch.rm_so = 0;
+    pmatch.rm_eo = 1;
+    if (regexec(&reg,c,1,&pmatch,REG_STARTEND) == 0)
+      set_add(s,i);
+  }
+  regfree(&reg);
+  return 0;
+}
+
+static int
+parse_bracket(struct parser *p)
+{
+  const uchar *src = p->src;
+  const size_t start = p->pos;
+  size_t pos = p->pos+1;
+  uchar negate = 0, oracle = (p->flags&REG_ICASE) ? 1 : 0, first = 1;
+  charset s = {{0}};
+
+  if (pos < p->size && src[pos] == '^') {
+    negate = 1;
+    pos++;
+  }
+  while (1) {
+    if (pos >= p->size)
+      return -1;
+    uchar c = src[pos];
+    if (c == ']' && !first) {
+      pos++;
+      break;
+    }
+    first = 0;
+
+    if (c == '[' && pos+1 < p->size && (src[pos+1] == ':' || src[pos+1] == '=' || src[pos+1] == '.')) {
+      uchar t = src[pos+1];
+      size_t end = pos+2;
+      while (end+1 < p->size && !(src[end] == t && src[end+1] == ']'))
+        end++;
+      if (end+1 >= p->size)
+        return -1;
+      if (t == ':') {
+        if (!class_add(&s,src+pos+2,end-pos-2))
+          return -1;
+      } else
+        oracle = 1;
+      pos = end+2;
+      if (pos+1 < p->size && src[pos] == '-' && src[pos+1] != ']')
+        return -1;
+      continue;
+    }
+
+    pos++;
+    if (pos+1 < p->size && src[pos] == '-' && src[pos+1] != ']') {
+      uchar hi = src[pos+1];
+      if (hi == '[' && pos+2 < p->size && (src[pos+2] == '.' || src[pos+2] == '=' || src[pos+2] == ':'))
+        return -1;
+      pos += 2;
+      if (c >= 0x80 || hi >= 0x80)
+        oracle = 1;
+      for (uint i = c; i <= hi; i++)
+        set_add(&s,i);
+    } else
+      set_add(&s,c);
+  }
+
+  if (oracle) {
+    if (bracket_oracle(p,start,pos,&s) == -1)
+      return -1;
+  } else if (negate) {
+    for (uint i = 0; i < 4; i++)
+      s.b[i] = ~s.b[i];
+  }
+  p->pos = pos;
+  return set_node(p,&s);
+}
+
+static int
+parse_interval(struct parser *p, int *min, int *max)
+{
+  const uchar *src = p->src;
+  uchar hasmin = 0, hasmax = 0;
+  *min = 0;
+  *max = 0;
+  while (p->pos < p->size && isdigit(src[p->pos])) {
+    *min = *min*10+(src[p->pos++]-'0');
+    if (*min > REP_MAX)
+      return -1;
+    hasmin = 1;
+  }
+  if (p->pos < p->size && src[p->pos] == ',') {
+    p->pos++;
+    while (p->pos < p->size && isdigit(src[p->pos])) {
+      *max = *max*10+(src[p->pos++]-'0');
+      if (*max > REP_MAX)
+        return -1;
+      hasmax = 1;
+    }
+    if (!hasmin && !hasmax)
+      return -1;
+    if (!hasmax)
+      *max = REP_INF;
+  } else {
+    if (!hasmin)
+      return -1;
+    *max = *min;
+  }
+
+  if (!(p->flags&REG_EXTENDED)) {
+    if (p->pos >= p->size || src[p->pos] != '\\')
+      return -1;
+    p->pos++;
+  }
+  if (p->pos >= p->size || src[p->pos] != '}')
+    return -1;
+  p->pos++;
+  if (*max != REP_INF && *max < *min)
+    return -1;
+  return 0;
+}
+
+static int parse_reg(struct parser *p, const uint depth);
+
+static int
+parse_group(struct parser *p, const uint depth)
+{
+  p->caret = 1;
+  int r = parse_reg(p,depth+1);
+  if (r == -1 || p->pos >= p->size || !at_close(p))
+    return -1;
+  p->pos += (p->flags&REG_EXTENDED) ? 1 : 2;
+  p->caret = 0;
+  return r;
+}
+
+static int
+parse_dup(struct parser *p, int r)
+{
+  const uchar *src = p->src;
+  const uchar extended = (p->flags&REG_EXTENDED) ? 1 : 0;
+  while (p->pos < p->size) {
+    int min, max;
+    uchar c = src[p->pos];
+    if (extended) {
+      if (c != '*' && c != '+' && c != '?' && c != '{')
+        break;
+    } else if (c == '\\' && p->pos+1 < p->size
+      && (src[p->pos+1] == '+' || src[p->pos+1] == '?' || src[p->pos+1] == '{')) {
+      c = src[++p->pos];
+    } else if (c != '*')
+      break;
+
+    p->pos++;
+    if (c == '{') {
+      if (parse_interval(p,&min,&max) == -1)
+        return -1;
+    } else {
+      min = (c == '+') ? 1 : 0;
+      max = (c == '?') ? 1 : REP_INF;
+    }
+
+    r = tnode_add(p,T_REP,r,0);
+    struct tnode *n = &((struct tnode*)p->tree->v)[r];
+    n->min = min;
+    n->max = max;
+  }
+  return r;
+}
+
+static int
+parse_expr(struct parser *p, const uint depth)
+{
+  const uchar *src = p->src;
+  uchar c = src[p->pos];
+  const uchar caret = p->caret;
+  p->caret = 0;
+  int r;
+
+  if (p->flags&REG_EXTENDED) {
+    switch (c) {
+      case '(':
+        p->pos++;
+        r = parse_group(p,depth);
+        break;
+      case '*': case '+': case '?': case '{':
+        return -1;
+      case '^':
+        p->pos++;
+        return tnode_add(p,T_BOL,0,0);
+      case '$':
+        p->pos++;
+        return tnode_add(p,T_EOL,0,0);
+      case '.':
+        goto DOT;
+      case '[':
+        r = parse_bracket(p);
+        break;
+      case '\\':
+        goto ESCAPE;
+      default:
+        p->pos++;
+        r = literal(p,c);
+    }
+    if (r == -1)
+      return -1;
+    return parse_dup(p,r);
+  }
+
+  switch (c) {
+    case '\\':
+      if (p->pos+1 < p->size) {
+        uchar d = src[p->pos+1];
+        if (d == '(') {
+          p->pos += 2;
+          r = parse_group(p,depth);
+          break;
+        }
+        if (d == '{')
+          return -1;
+        if (d == '+' || d == '?') {
+          p->pos += 2;
+          r = literal(p,d);
+          break;
+        }
+      }
+      goto ESCAPE;
+    case '*':
+      p->pos++;
+      r = literal(p,c);
+      break;
+    case '^':
+      p->pos++;
+      if (caret)
+        return tnode_add(p,T_BOL,0,0);
+      r = literal(p,c);
+      break;
+    case '$':
+      p->pos++;
+      if (p->pos == p->size || (src[p->pos] == '\\' && p->pos+1 < p->size
+        && (src[p->pos+1] == '|' || src[p->pos+1] == ')')))
+        return tnode_add(p,T_EOL,0,0);
+      r = literal(p,c);
+      break;
+    case '.':
+      goto DOT;
+    case '[':
+      r = parse_bracket(p);
+      break;
+    default:
+      p->pos++;
+      r = literal(p,c);
+  }
+  if (r == -1)
+    return -1;
+  return parse_dup(p,r);
+
+  DOT: ;
+  charset s;
+  memset(&s,0xff,sizeof(s));
+  s.b[0] &= ~((uint64_t)1);
+  p->pos++;
+  return parse_dup(p,set_node(p,&s));
+
+  ESCAPE: ;
+  if (p->pos+1 >= p->size)
+    return -1;
+  c = src[p->pos+1];
+  if (isalnum(c) || c >= 0x80 || c == '<' || c == '>' || c == '`' || c == '\'') {
+    if (!p->opaque)
+      return -1;
+    p->pos += 2;
+    return parse_dup(p,tnode_add(p,T_OPAQUE,0,0));
+  }
+  p->pos += 2;
+  return parse_dup(p,literal(p,c));
+}
+
+static int
+parse_branch(struct parser *p, const uint depth)
+{
+  int r = tnode_add(p,T_EMPTY,0,0);
+  while (p->pos < p->size && !at_alt(p) && !at_close(p)) {
+    int e = parse_expr(p,depth);
+    if (e == -1)
+      return -1;
+    r = tnode_add(p,T_CAT,r,e);
+  }
+  return r;
+}
+
+static int
+parse_reg(struct parser *p, const uint depth)
+{
+  int r = parse_branch(p,depth);
+  while (r != -1 && p->pos < p->size && at_alt(p)) {
+    p->pos += (p->flags&REG_EXTENDED) ? 1 : 2;
+    p->caret = 1;
+    int l = parse_branch(p,depth);
+    if (l == -1)
+      return -1;
+    r = tnode_add(p,T_ALT,r,l);
+  }
+  return r;
+}
+
+struct nfa {
+  flexarr *states; //struct nstate
+  const struct tnode *tree;
+};
+
+static int
+nstate_add(struct nfa *n, const uchar type, const uint out, const uint out1)
+{
+  if (n->states->size >= NFA_MAX)
+    return -1;
+  struct nstate *s = flexarr_inc(n->states);
+  s->type = type;
+  s->out = out;
+  s->out1 = out1;
+  return n->states->size-1;
+}
+
+//builds nfa of node backwards, returning state entering it
+static int
+nfa_build(struct nfa *n, const uint node, const int next)
+{
+  if (next == -1)
+    return -1;
+  const struct tnode *t = &n->tree[node];
+  switch (t->type) {
+    case T_SET:
+      return nstate_add(n,N_SET,next,t->a);
+    case T_EMPTY:
+      return next;
+    case T_BOL:
+      return nstate_add(n,N_BOL,next,0);
+    case T_EOL:
+      return nstate_add(n,N_EOL,next,0);
+    case T_CAT:
+      return nfa_build(n,t->a,nfa_build(n,t->b,next));
+    case T_ALT: {
+      int l = nfa_build(n,t->a,next);
+      int r = nfa_build(n,t->b,next);
+      if (l == -1 || r == -1)
+        return -1;
+      return nstate_add(n,N_SPLIT,l,r);
+    }
+    case T_REP: {
+      int r = next;
+      if (t->max == REP_INF) {
+        int loop = nstate_add(n,N_SPLIT,0,next);
+        if (loop == -1)
+          return -1;
+        int body = nfa_build(n,t->a,loop);
+        if (body == -1)
+          return -1;
+        ((struct nstate*)n->states->v)[loop].out = body;
+        r = loop;
+      } else {
+        for (int i = t->min; i < t->max && r != -1; i++) {
+          int body = nfa_build(n,t->a,r);
+          if (body == -1)
+            return -1;
+          r = nstate_add(n,N_SPLIT,body,next);
+        }
+      }
+      for (int i = 0; i < t->min && r != -1; i++)
+        r = nfa_build(n,t->a,r);
+      return r;
+    }
+  }
+  return -1;
+}
+
+struct dstate {
+  uint *v; //sorted nfa states
+  uint size;
+  uint hash;
+};
+
+struct subset {
+  const struct nstate *states;
+  uint statesl;
+  uint *mark;
+  uint gen;
+  uint *stack;
+  uint *list;
+  uint listl;
+};
+
+static void
+closure_add(struct subset *s, uint st, const uchar bol)
+{
+  uint stackl = 0;
+  s->stack[stackl++] = st;
+  while (stackl) {
+    st = s->stack[--stackl];
+    if (s->mark[st] == s->gen)
+      continue;
+    s->mark[st] = s->gen;
+    const struct nstate *n = &s->states[st];
+    switch (n->type) {
+      case N_SPLIT:
+        s->stack[stackl++] = n->out1;
+        s->stack[stackl++] = n->out;
+        break;
+      case N_BOL:
+        if (bol)
+          s->stack[stackl++] = n->out;
+        break;
+      default:
+        s->list[s->listl++] = st;
+    }
+  }
+}
+
+static int
+uint_cmp(const void *a, const void *b)
+{
+  uint x = *(const uint*)a, y = *(const uint*)b;
+  return (x > y) - (x < y);
+}
+
+static uchar
+dstate_flags(struct subset *s, const uint *v, const uint size)
+{
+  uchar hasset = 0;
+  s->gen++;
+  uint stackl = 0;
+  for (uint i = 0; i < size; i++) {
+    const struct nstate *n = &s->states[v[i]];
+    if (n->type == N_MATCH)
+      return D_ACCEPT;
+    if (n->type == N_SET)
+      hasset = 1;
+    else if (n->type == N_EOL)
+      s->stack[stackl++] = n->out;
+  }
+  while (stackl) {
+    uint st = s->stack[--stackl];
+    if (s->mark[st] == s->gen)
+      continue;
+    s->mark[st] = s->gen;
+    const struct nstate *n = &s->states[st];
+    if (n->type == N_MATCH)
+      return D_ACCEPT_END;
+    if (n->type == N_SPLIT) {
+      s->stack[stackl++] = n->out1;
+      s->stack[stackl++] = n->out;
+    } else if (n->type == N_EOL)
+      s->stack[stackl++] = n->out;
+  }
+  return hasset ? 0 : D_DEAD;
+}
+
+//finds or adds state of s->list, returns -1 if there are too many of them
+static int
+dstate_get(struct subset *s, flexarr *dstates)
+{
+  qsort(s->list,s->listl,sizeof(uint),uint_cmp);
+  uint hash = 2166136261u;
+  for (uint i = 0; i < s->listl; i++)
+    hash = (hash^s->list[i])*16777619u;
+
+  struct dstate *d = (struct dstate*)dstates->v;
+  for (size_t i = 0; i < dstates->size; i++)
+    if (d[i].hash == hash && d[i].size == s->listl
+      && memcmp(d[i].v,s->list,s->listl*sizeof(uint)) == 0)
+      return i;
+  if (dstates->size >= DFA_MAX)
+    return -1;
+
+  struct dstate *new = flexarr_inc(dstates);
+  new->size = s->listl;
+  new->hash = hash;
+  new->v = malloc((s->listl ? s->listl : 1)*sizeof(uint));
+  memcpy(new->v,s->list,s->listl*sizeof(uint));
+  return dstates->size-1;
+}
+
+static void
+byte_classes(struct dfa *dfa, const charset *sets, const size_t setsl)
+{
+  //newline is always distinguished since '^' matches after it
+  memset(dfa->classes,0,256);
+  dfa->classes['\n'] = 1;
+  uint classesl = 2;
+  for (size_t i = 0; i < setsl; i++) {
+    short map[512];
+    uchar classes[256];
+    uint n = 0;
+    memset(map,-1,sizeof(map));
+    for (uint j = 0; j < 256; j++) {
+      uint key = (dfa->classes[j]<<1)|set_has(&sets[i],j);
+      if (map[key] == -1)
+        map[key] = n++;
+      classes[j] = map[key];
+    }
+    memcpy(dfa->classes,classes,256);
+    classesl = n;
+  }
+  dfa->classesl = classesl;
+}
+
+//if only few bytes can start a match they can be searched for with scan_chars()
+static void
+first_bytes(struct dfa *dfa)
+{
+  dfa->firstl = 0;
+  if (dfa->flags[dfa->idle]&(D_ACCEPT|D_DEAD))
+    return;
+  const ushort *t = dfa->trans+dfa->idle*dfa->classesl;
+  uint firstl = 0;
+  for (uint i = 0; i < 256; i++) {
+    if (t[dfa->classes[i]] == dfa->idle)
+      continue;
+    if (firstl >= sizeof(dfa->first))
+      return;
+    dfa->first[firstl++] = i;
+  }
+  dfa->firstl = firstl;
+}
+
+static struct dfa *
+determinize(const struct nstate *states, const uint statesl, const uint start, const charset *sets, const size_t setsl)
+{
+  struct dfa *dfa = malloc(sizeof(struct dfa));
+  byte_classes(dfa,sets,setsl);
+  uchar repr[256]; //byte representing each class
+  for (int i = 255; i >= 0; i--)
+    repr[dfa->classes[i]] = i;
+
+  struct subset s;
+  s.states = states;
+  s.statesl = statesl;
+  s.mark = calloc(statesl,sizeof(uint));
+  s.gen = 1;
+  s.stack = malloc((statesl*3+1)*sizeof(uint));
+  s.list = malloc((statesl+1)*sizeof(uint));
+  s.listl = 0;
+
+  flexarr *dstates = flexarr_init(sizeof(struct dstate),16);
+  flexarr *trans = flexarr_init(sizeof(ushort),256);
+  flexarr *flags = flexarr_init(sizeof(uchar),16);
+  uchar fail = 0;
+
+  closure_add(&s,start,1);
+  dstate_get(&s,dstates);
+  s.gen++;
+  s.listl = 0;
+  closure_add(&s,start,0);
+  dfa->idle = dstate_get(&s,dstates);
+
+  for (size_t i = 0; i < dstates->size && !fail; i++) {
+    struct dstate *d = &((struct dstate*)dstates->v)[i];
+    uchar f = dstate_flags(&s,d->v,d->size);
+    *(uchar*)flexarr_inc(flags) = f;
+    flexarr_alloc(trans,dfa->classesl);
+    trans->size += dfa->classesl;
+    ushort *t = &((ushort*)trans->v)[i*dfa->classesl];
+
+    for (uint c = 0; c < dfa->classesl; c++) {
+      if (f&(D_ACCEPT|D_DEAD)) {
+        t[c] = i;
+        continue;
+      }
+      d = &((struct dstate*)dstates->v)[i];
+      s.gen++;
+      s.listl = 0;
+      for (uint j = 0; j < d->size; j++) {
+        const struct nstate *n = &states[d->v[j]];
+        if (n->type == N_SET && set_has(&sets[n->out1],repr[c]))
+          closure_add(&s,n->out,repr[c] == '\n');
+      }
+      closure_add(&s,start,0);
+      int r = dstate_get(&s,dstates);
+      if (r == -1) {
+        fail = 1;
+        break;
+      }
+      t = &((ushort*)trans->v)[i*dfa->classesl];
+      t[c] = r;
+    }
+  }
+
+  struct dstate *d = (struct dstate*)dstates->v;
+  for (size_t i = 0; i < dstates->size; i++)
+    free(d[i].v);
+  dfa->statesl = dstates->size;
+  flexarr_free(dstates);
+  free(s.mark);
+  free(s.stack);
+  free(s.list);
+
+  if (fail) {
+    flexarr_free(trans);
+    flexarr_free(flags);
+    free(dfa);
+    return NULL;
+  }
+  size_t unused;
+  flexarr_conv(trans,(void**)&dfa->trans,&unused);
+  flexarr_conv(flags,(void**)&dfa->flags,&unused);
+  first_bytes(dfa);
+  return dfa;
+}
+
+/* regexec() lets '$' match before newline if something consumes it
+   afterwards, only '$' at the end of pattern is supported */
+static uchar
+eol_final(const struct nstate *states, const uint statesl)
+{
+  uint *stack = malloc((statesl*3+1)*sizeof(uint));
+  uchar *visited = calloc(statesl,1);
+  uchar ret = 1;
+  for (uint i = 0; i < statesl && ret; i++) {
+    if (states[i].type != N_EOL)
+      continue;
+    uint stackl = 0;
+    stack[stackl++] = states[i].out;
+    while (stackl) {
+      uint st = stack[--stackl];
+      if (visited[st])
+        continue;
+      visited[st] = 1;
+      const struct nstate *n = &states[st];
+      if (n->type == N_SET || n->type == N_BOL) {
+        ret = 0;
+        break;
+      }
+      if (n->type == N_SPLIT)
+        stack[stackl++] = n->out1;
+      if (n->type != N_MATCH)
+        stack[stackl++] = n->out;
+    }
+  }
+  free(stack);
+  free(visited);
+  return ret;
+}
+
+static int
+parse(struct parser *p, const char *src, const int flags, const uchar opaque)
+{
+  p->src = (const uchar*)src;
+  p->pos = 0;
+  p->size = strlen(src);
+  p->flags = flags&(REG_EXTENDED|REG_ICASE);
+  p->tree = flexarr_init(sizeof(struct tnode),32);
+  p->sets = flexarr_init(sizeof(charset),16);
+  p->caret = 1;
+  p->opaque = opaque;
+
+  int root = parse_reg(p,0);
+  if (root == -1 || p->pos != p->size)
+    return -1;
+  return root;
+}
+
+static void
+parser_free(struct parser *p)
+{
+  flexarr_free(p->tree);
+  flexarr_free(p->sets);
+}
+
+struct dfa *
+dfa_comp(const char *src, const int flags)
+{
+  if (MB_CUR_MAX > 1)
+    return NULL;
+
+  struct parser p;
+  struct dfa *ret = NULL;
+  int root = parse(&p,src,flags,0);
+  if (root == -1)
+    goto END;
+
+  struct nfa n;
+  n.states = flexarr_init(sizeof(struct nstate),64);
+  n.tree = (struct tnode*)p.tree->v;
+  int match = nstate_add(&n,N_MATCH,0,0);
+  int start = nfa_build(&n,root,match);
+  if (start != -1 && eol_final((struct nstate*)n.states->v,n.states->size))
+    ret = determinize((struct nstate*)n.states->v,n.states->size,start,
+      (charset*)p.sets->v,p.sets->size);
+  flexarr_free(n.states);
+
+  END: ;
+  parser_free(&p);
+  return ret;
+}
+
+//strings that every match of node has to contain
+struct must {
+  uchar exact; //node matches only s
+  uchar s[MUST_MAX]; //prefix of every match
+  uchar r[MUST_MAX]; //suffix of every match
+  uchar in[MUST_MAX];
+  uchar sl;
+  uchar rl;
+  uchar inl;
+};
+
+static void
+must_copy(uchar *dest, uchar *destl, const uchar *src, const size_t srcl)
+{
+  memmove(dest,src,srcl);
+  *destl = srcl;
+}
+
+static void
+must_exact(struct must *m, const uchar *s, const size_t sl)
+{
+  m->exact = 1;
+  must_copy(m->s,&m->sl,s,sl);
+  must_copy(m->r,&m->rl,s,sl);
+  must_copy(m->in,&m->inl,s,sl);
+}
+
+static void
+must_longest(struct must *m, const uchar *s, const size_t sl)
+{
+  if (sl > m->inl)
+    must_copy(m->in,&m->inl,s,sl);
+}
+
+//returns byte that set is made of, taking case into account, or -1
+static int
+set_char(const charset *set, const uchar icase)
+{
+  int c = -1;
+  for (uint i = 0; i < 256; i++) {
+    if (!set_has(set,i))
+      continue;
+    if (c == -1)
+      c = i;
+    else if (!icase || tolower(i) != tolower(c))
+      return -1;
+  }
+  if (c == -1)
+    return -1;
+  if (icase) {
+    for (uint i = 0; i < 256; i++)
+      if (tolower(i) == tolower(c) && !set_has(set,i))
+        return -1;
+    c = tolower(c);
+  }
+  return c;
+}
+
+static void
+must_get(const struct parser *p, const uint node, struct must *m)
+{
+  const struct tnode *t = &((struct tnode*)p->tree->v)[node];
+  memset(m,0,sizeof(*m));
+  switch (t->type) {
+    case T_SET: {
+      int c = set_char(&((charset*)p->sets->v)[t->a],(p->flags&REG_ICASE) ? 1 : 0);
+      if (c != -1) {
+        uchar b = c;
+        must_exact(m,&b,1);
+      }
+      break;
+    }
+    case T_EMPTY:
+    case T_BOL:
+    case T_EOL:
+      m->exact = 1;
+      break;
+    case T_CAT: {
+      struct must a, b;
+      must_get(p,t->a,&a);
+      must_get(p,t->b,&b);
+      if (a.exact && b.exact && a.sl+b.sl <= MUST_MAX) {
+        memcpy(a.s+a.sl,b.s,b.sl);
+        must_exact(m,a.s,a.sl+b.sl);
+        break;
+      }
+
+      uchar tmp[MUST_MAX*2];
+      must_copy(m->s,&m->sl,a.s,a.sl);
+      if (a.exact) {
+        memcpy(tmp,a.s,a.sl);
+        memcpy(tmp+a.sl,b.s,b.sl);
+        must_copy(m->s,&m->sl,tmp,(a.sl+b.sl > MUST_MAX) ? MUST_MAX : a.sl+b.sl);
+      }
+      must_copy(m->r,&m->rl,b.r,b.rl);
+      if (b.exact) {
+        memcpy(tmp,a.r,a.rl);
+        memcpy(tmp+a.rl,b.r,b.rl);
+        size_t l = (a.rl+b.rl > MUST_MAX) ? MUST_MAX : a.rl+b.rl;
+        must_copy(m->r,&m->rl,tmp+a.rl+b.rl-l,l);
+      }
+
+      must_longest(m,a.in,a.inl);
+      must_longest(m,b.in,b.inl);
+      must_longest(m,m->s,m->sl);
+      must_longest(m,m->r,m->rl);
+      memcpy(tmp,a.r,a.rl);
+      memcpy(tmp+a.rl,b.s,b.sl);
+      must_longest(m,tmp,(a.rl+b.sl > MUST_MAX) ? MUST_MAX : a.rl+b.sl);
+      break;
+    }
+    case T_ALT: {
+      struct must a, b;
+      must_get(p,t->a,&a);
+      must_get(p,t->b,&b);
+      if (a.exact && b.exact && a.sl == b.sl && memcmp(a.s,b.s,a.sl) == 0) {
+        *m = a;
+        break;
+      }
+      uchar l = 0;
+      while (l < a.sl && l < b.sl && a.s[l] == b.s[l])
+        l++;
+      must_copy(m->s,&m->sl,a.s,l);
+      l = 0;
+      while (l < a.rl && l < b.rl && a.r[a.rl-l-1] == b.r[b.rl-l-1])
+        l++;
+      must_copy(m->r,&m->rl,a.r+a.rl-l,l);
+      must_longest(m,m->s,m->sl);
+      must_longest(m,m->r,m->rl);
+      break;
+    }
+    case T_REP:
+      if (t->min == 0)
+        break;
+      must_get(p,t->a,m);
+      if (m->exact && t->min == t->max && m->sl*t->min <= MUST_MAX) {
+        uchar tmp[MUST_MAX];
+        for (int i = 0; i < t->min; i++)
+          memcpy(tmp+i*m->sl,m->s,m->sl);
+        must_exact(m,tmp,m->sl*t->min);
+      } else
+        m->exact = 0;
+      break;
+  }
+}
+
+char *
+dfa_literal(const char *src, const int flags, size_t *len)
+{
+  *len = 0;
+  if (MB_CUR_MAX > 1)
+    return NULL;
+
+  struct parser p;
+  char *ret = NULL;
+  int root = parse(&p,src,flags,1);
+  if (root != -1) {
+    struct must m;
+    must_get(&p,root,&m);
+    if (m.inl) {
+      ret = malloc(m.inl);
+      memcpy(ret,m.in,m.inl);
+      *len = m.inl;
+    }
+  }
+  parser_free(&p);
+  return ret;
+}
+
+int
+dfa_exec(const struct dfa *dfa, const char *ptr, const size_t size)
+{
+  const uchar *s = (const uchar*)ptr;
+  const ushort *trans = dfa->trans;
+  const uchar *classes = dfa->classes;
+  const uint classesl = dfa->classesl;
+  uint state = 0;
+  uchar f = dfa->flags[0];
+
+  for (size_t i = 0; i < size && !(f&(D_ACCEPT|D_DEAD)); i++) {
+    if (state == dfa->idle && dfa->firstl) {
+      i = scan_chars(ptr,i,size,dfa->first,dfa->firstl);
+      if (i == size)
+        break;
+    }
+    state = trans[state*classesl+classes[s[i]]];
+    f = dfa->flags[state];
+  }
+  return (f&(D_ACCEPT|D_ACCEPT_END)) ? 1 : 0;
+}
+
+void
+dfa_free(struct dfa *dfa)
+{
+  if (!dfa)
+    return;
+  free(dfa->trans);
+  free(dfa->flags);
+  free(dfa);
+}
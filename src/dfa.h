@@ -0,0 +1,38 @@
+/*
+    reliq - html searching tool
+    Copyright (C) 2020-2024 Dominik Stanisław Suchora <suchora.dominik7@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DFA_H
+#define DFA_H
+
+struct dfa {
+  unsigned short *trans; //next state for every state and class of bytes
+  unsigned char *flags; //of states
+  unsigned char classes[256]; //class of every byte, bytes in the same class are never told apart
+  unsigned short classesl;
+  unsigned short statesl;
+  unsigned short idle; //state in which nothing is matched yet
+  char first[4]; //bytes leaving idle state
+  unsigned char firstl; //0 if there are too many of them
+};
+
+struct dfa *dfa_comp(const char *src, const int flags);
+char *dfa_literal(const char *src, const int flags, size_t *len);
+int dfa_exec(const struct dfa *dfa, const char *ptr, const size_t size);
+void dfa_free(struct dfa *dfa);
+
+#endif
@@ -26,6 +26,7 @@
 #include <string.h>
 #include <regex.h>
 #include <limits.h>
+#include <stdint.h>
 
 typedef unsigned char uchar;
 typedef unsigned short ushort;
@@ -33,6 +34,7 @@ typedef unsigned int uint;
 typedef unsigned long int ulong;
 
 #include "reliq.h"
+#include "hnode.h"
 #include "flexarr.h"
 #include "ctype.h"
 #include "utils.h"
@@ -41,25 +43,25 @@ typedef unsigned long int ulong;
 #define SED_MAX_PATTERN_SPACE (1<<20)
 
 const struct reliq_format_function format_functions[] = {
-    {{"trim",4},trim_edit},
-    {{"tr",2},tr_edit},
-    {{"cut",3},cut_edit},
-    {{"sed",3},sed_edit},
-    {{"line",4},line_edit},
-    {{"sort",4},sort_edit},
-    {{"uniq",4},uniq_edit},
-    {{"echo",4},echo_edit},
+    {{"trim",4},trim_edit,FORMAT_ARG0_ISSTR,0},
+    {{"tr",2},tr_edit,FORMAT_ARG0_ISSTR|FORMAT_ARG1_ISSTR|FORMAT_ARG2_ISSTR,0},
+    {{"cut",3},cut_edit,FORMAT_ARG1_ISSTR|FORMAT_ARG2_ISSTR|FORMAT_ARG3_ISSTR,FORMAT_ARG0_ISSTR},
+    {{"sed",3},sed_edit,FORMAT_ARG0_ISSTR|FORMAT_ARG1_ISSTR|FORMAT_ARG2_ISSTR,0},
+    {{"line",4},line_edit,FORMAT_ARG1_ISSTR,FORMAT_ARG0_ISSTR},
+    {{"sort",4},sort_edit,FORMAT_ARG0_ISSTR|FORMAT_ARG1_ISSTR,0},
+    {{"uniq",4},uniq_edit,FORMAT_ARG0_ISSTR,0},
+    {{"echo",4},echo_edit,FORMAT_ARG0_ISSTR|FORMAT_ARG1_ISSTR,0},
 };
 
 reliq_error *
-format_exec(char *input, size_t inputl, FILE *output, const reliq_hnode *hnode, const reliq_hnode *parent, const reliq_format_func *format, const size_t formatl, const reliq *rq)
+format_exec(char *input, size_t inputl, FILE *output, const reliq_chnode *hnode, const reliq_chnode *parent, const reliq_format_func *format, const size_t formatl, const reliq *rq)
 {
   if (hnode && (!formatl || (formatl == 1 && (format[0].flags&FORMAT_FUNC) == 0 && (!format[0].arg[0] || !((reliq_cstr*)format[0].arg[0])->b)))) {
-    reliq_print(output,hnode);
+    hnode_print(output,hnode,rq);
     return NULL;
   }
   if (hnode && formatl == 1 && (format[0].flags&FORMAT_FUNC) == 0 && format[0].arg[0] && ((reliq_cstr*)format[0].arg[0])->b) {
-    reliq_printf(output,((reliq_cstr*)format[0].arg[0])->b,((reliq_cstr*)format[0].arg[0])->s,hnode,parent,rq);
+    hnode_printf(output,((reliq_cstr*)format[0].arg[0])->b,((reliq_cstr*)format[0].arg[0])->s,hnode,parent,rq);
     return NULL;
   }
 
@@ -71,12 +73,12 @@ format_exec(char *input, size_t inputl, FILE *output, const reliq_hnode *hnode,
   for (size_t i = 0; i < formatl; i++) {
     out = (i == formatl-1) ? output : open_memstream(&ptr[1],&fsize[1]);
     if (hnode && i == 0 && (format[i].flags&FORMAT_FUNC) == 0) {
-      reliq_printf(out,((reliq_cstr*)format[i].arg[0])->b,((reliq_cstr*)format[i].arg[0])->s,hnode,parent,rq);
+      hnode_printf(out,((reliq_cstr*)format[i].arg[0])->b,((reliq_cstr*)format[i].arg[0])->s,hnode,parent,rq);
     } else {
       if (i == 0) {
         if (hnode) {
           FILE *t = open_memstream(&ptr[0],&fsize[0]);
-          reliq_print(t,hnode);
+          hnode_print(t,hnode,rq);
           fclose(t);
         } else {
           ptr[0] = input;
@@ -214,6 +216,68 @@ format_free(reliq_format_func *format, size_t formatl)
   free(format);
 }
 
+void
+format_save(const reliq_format_func *format, const size_t formatl, FILE *output)
+{
+  uint64_t l = formatl;
+  fwrite(&l,sizeof(l),1,output);
+  for (size_t i = 0; i < formatl; i++) {
+    fwrite(&format[i].flags,1,1,output);
+    for (size_t j = 0; j < 4; j++) {
+      uchar isset = format[i].arg[j] ? 1 : 0;
+      fwrite(&isset,1,1,output);
+      if (!isset)
+        continue;
+
+      if (format[i].flags&(FORMAT_ARG0_ISSTR<<j)) {
+        reliq_str *str = (reliq_str*)format[i].arg[j];
+        save_str(str->b,str->s,output);
+      } else
+        range_save((reliq_range*)format[i].arg[j],output);
+    }
+  }
+}
+
+int
+format_load(reliq_format_func **format, size_t *formatl, const char *ptr, const size_t size, size_t *pos)
+{
+  *format = NULL;
+  *formatl = 0;
+  size_t l;
+  if (load_count(&l,1,ptr,size,pos))
+    return -1;
+  if (!l)
+    return 0;
+  reliq_format_func *f = *format = calloc(l,sizeof(reliq_format_func));
+  *formatl = l;
+
+  for (size_t i = 0; i < l; i++) {
+    if (load_bytes(&f[i].flags,1,ptr,size,pos) || (size_t)(f[i].flags&FORMAT_FUNC) > LENGTH(format_functions))
+      return -1;
+    uchar func = f[i].flags&FORMAT_FUNC;
+    //printf takes only its format string
+    uchar strs = func ? format_functions[func-1].strs : FORMAT_ARG0_ISSTR;
+    uchar ranges = func ? format_functions[func-1].ranges : 0;
+    for (size_t j = 0; j < 4; j++) {
+      uchar isset;
+      if (load_bytes(&isset,1,ptr,size,pos))
+        return -1;
+      if (!isset)
+        continue;
+
+      uchar isstr = f[i].flags&(FORMAT_ARG0_ISSTR<<j);
+      if (!((isstr ? strs : ranges)&(FORMAT_ARG0_ISSTR<<j)))
+        return -1;
+      if (isstr) {
+        if (load_str(f[i].arg[j] = malloc(sizeof(reliq_str)),ptr,size,pos))
+          return -1;
+      } else if (range_load(f[i].arg[j] = malloc(sizeof(reliq_range)),ptr,size,pos))
+        return -1;
+    }
+  }
+  return 0;
+}
+
 const struct { char *name; size_t namel; const char *arr; } tr_ctypes[] = {
   {"space",5,IS_SPACE},
   {"alnum",5,IS_ALNUM},
@@ -860,7 +924,7 @@ sed_script_comp_pre(const char *src, size_t size, int eflags, flexarr **script)
           return reliq_set_error(1,"sed: char %u: strings for `%c' command are different lenghts",pos,command->name);
         }
         sedexpr->arg1 = malloc(256*sizeof(char));
-        sedexpr->arg2 = malloc(256*sizeof(uchar));
+        sedexpr->arg2 = calloc(256,sizeof(uchar));
         for (size_t i = 0; i < sedexpr->arg.s; i++) {
           if (i+1 < sedexpr->arg.s && sedexpr->arg.b[i] == '\\' && sedexpr->arg.b[i+1] == argdelim)
             i++;
@@ -1585,7 +1649,7 @@ cut_edit(char *src, size_t size, FILE *output, const void *arg[4], const unsigne
 
   if (arg[0]) {
     if (flag&FORMAT_ARG0_ISSTR)
-      reliq_set_error(1,"%s: arg %d: incorrect type of argument, expected range","cut",1);
+      return reliq_set_error(1,"%s: arg %d: incorrect type of argument, expected range","cut",1);
     range = (reliq_range*)arg[0];
   }
 
@@ -29,6 +29,8 @@
 struct reliq_format_function {
   reliq_str8 name;
   reliq_error *(*func)(char*,size_t,FILE*,const void*[4],const unsigned char);
+  unsigned char strs; //FORMAT_ARG*_ISSTR of arguments that can be strings
+  unsigned char ranges; //same but of arguments that can be ranges
 };
 
 reliq_error *trim_edit(char *src, size_t size, FILE *output, const void *arg[4], const unsigned char flag);
@@ -42,8 +44,10 @@ reliq_error *echo_edit(char *src, size_t size, FILE *output, const void *arg[4],
 
 extern const struct reliq_format_function format_functions[];
 
-reliq_error *format_exec(char *input, size_t inputl, FILE *output, const reliq_hnode *hnode, const reliq_hnode *parent, const reliq_format_func *format, const size_t formatl, const reliq *rq);
+reliq_error *format_exec(char *input, size_t inputl, FILE *output, const reliq_chnode *hnode, const reliq_chnode *parent, const reliq_format_func *format, const size_t formatl, const reliq *rq);
 void format_free(reliq_format_func *format, size_t formatl);
 reliq_error *format_get_funcs(flexarr *format, char *src, size_t *pos, size_t *size);
+void format_save(const reliq_format_func *format, const size_t formatl, FILE *output);
+int format_load(reliq_format_func **format, size_t *formatl, const char *ptr, const size_t size, size_t *pos);
 
 #endif
@@ -88,7 +88,7 @@ flexarr_add(flexarr *dst, const flexarr *src) //append contents of src to dst
 void *
 flexarr_clearb(flexarr *f) //clear buffer
 {
-  if (f->size == f->asize || !f->v)
+  if (f->size == f->asize || !f->v || !f->size) //realloc() to 0 would free it
       return NULL;
   void *v = realloc(f->v,f->size*f->elsize);
   if (v == NULL)
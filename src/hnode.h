@@ -0,0 +1,54 @@
+/*
+    reliq - html searching tool
+    Copyright (C) 2020-2024 Dominik Stanisław Suchora <suchora.dominik7@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef HNODE_H
+#define HNODE_H
+
+//layout of nodes isn't part of library, reliq.h only declares reliq_chnode and reliq_span_pair
+
+typedef struct {
+  unsigned int b; //offset from the beginning of data
+  unsigned int s;
+} reliq_span;
+
+struct reliq_span_pair {
+  reliq_span f;
+  reliq_span s;
+}; //attrib of reliq_chnode
+
+struct reliq_chnode {
+  reliq_span all;
+  reliq_span tag;
+  reliq_span insides;
+  unsigned int attribs; //index of first attrib in attribs of reliq, or end of start tag if attribs are lazy
+  unsigned int child_count;
+  unsigned int parent; //distance to parent, 0 if it's at the top
+  unsigned int prev; //distance to previous sibling, 0 if it's the first
+  unsigned short attribsl; //0 if attribs are lazy
+  unsigned short lvl;
+  unsigned short tag_id; //id of known tag, 0 otherwise
+  unsigned char tag_flags; //RELIQ_HNODE_* flags of known tag
+}; //compact html node, the way nodes are stored
+
+int hnode_match(const reliq *rq, const reliq_chnode *hnode, const reliq_chnode *parent, const reliq_node *node);
+int hnode_match_tag(const reliq *rq, const reliq_chnode *hnode, const reliq_node *node);
+
+void hnode_printf(FILE *outfile, const char *format, const size_t formatl, const reliq_chnode *hnode, const reliq_chnode *parent, const reliq *rq);
+void hnode_print(FILE *outfile, const reliq_chnode *hnode, const reliq *rq);
+
+#endif
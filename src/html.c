@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <regex.h>
+#include <stdint.h>
 
 typedef unsigned char uchar;
 typedef unsigned short ushort;
@@ -32,31 +33,149 @@ typedef unsigned int uint;
 typedef unsigned long int ulong;
 
 #include "reliq.h"
+#include "hnode.h"
 #include "flexarr.h"
 #include "ctype.h"
 #include "utils.h"
 #include "edit.h"
 #include "output.h"
 #include "html.h"
+#include "scan.h"
 
-const reliq_str8 selfclosing_s[] = { //tags that don't end with </tag>
-  {"br",2},{"hr",2},{"img",3},{"input",5},{"col",3},{"embed",5},
-  {"area",4},{"base",4},{"link",4},{"meta",4},{"param",5},
-  {"source",6},{"track",5},{"wbr",3},{"command",7},
-  {"keygen",6},{"menuitem",8}
+#define HTML_STACK_INC (1<<6)
+#define HTML_NODES_INC (1<<13)
+#define HTML_ATTRIBS_INC (1<<13)
+
+#define spancomp(f,x,y) memcomp(f+x.b,f+y.b,x.s,y.s)
+
+struct html_tag {
+  char *b;
+  uchar s;
+  uchar flags;
 };
 
-const reliq_str8 script_s[] = { //tags which insides should be ommited
-  {"script",6},{"style",5}
+const struct html_tag tags_s[] = { //known tags sorted by length, their ids are positions in the array+1
+  {"a",1,0},{"b",1,0},{"i",1,0},{"p",1,RELIQ_HNODE_AUTOCLOSING},{"q",1,0},
+  {"s",1,0},{"u",1,0},{"br",2,RELIQ_HNODE_SELFCLOSING},{"dd",2,0},{"dl",2,0},
+  {"dt",2,0},{"em",2,0},{"h1",2,0},{"h2",2,0},{"h3",2,0},{"h4",2,0},{"h5",2,0},
+  {"h6",2,0},{"hr",2,RELIQ_HNODE_SELFCLOSING},{"li",2,0},{"ol",2,0},
+  {"rp",2,RELIQ_HNODE_AUTOCLOSING},{"rt",2,RELIQ_HNODE_AUTOCLOSING},
+  {"td",2,RELIQ_HNODE_AUTOCLOSING},{"th",2,RELIQ_HNODE_AUTOCLOSING},
+  {"tr",2,RELIQ_HNODE_AUTOCLOSING},{"tt",2,0},{"ul",2,0},{"bdi",3,0},
+  {"bdo",3,0},{"big",3,0},{"col",3,RELIQ_HNODE_SELFCLOSING},{"del",3,0},
+  {"dfn",3,0},{"dir",3,0},{"div",3,0},{"img",3,RELIQ_HNODE_SELFCLOSING},
+  {"ins",3,0},{"kbd",3,0},{"map",3,0},{"nav",3,0},{"pre",3,0},{"sub",3,0},
+  {"sup",3,0},{"svg",3,0},{"var",3,0},{"wbr",3,RELIQ_HNODE_SELFCLOSING},
+  {"abbr",4,0},{"area",4,RELIQ_HNODE_SELFCLOSING},
+  {"base",4,RELIQ_HNODE_SELFCLOSING},{"body",4,0},{"cite",4,0},{"code",4,0},
+  {"data",4,0},{"font",4,0},{"form",4,0},{"head",4,0},{"html",4,0},
+  {"link",4,RELIQ_HNODE_SELFCLOSING},{"main",4,0},{"mark",4,0},{"menu",4,0},
+  {"meta",4,RELIQ_HNODE_SELFCLOSING},{"nobr",4,0},{"ruby",4,0},{"samp",4,0},
+  {"slot",4,0},{"span",4,0},{"time",4,0},{"aside",5,0},{"audio",5,0},
+  {"embed",5,RELIQ_HNODE_SELFCLOSING},{"frame",5,0},
+  {"input",5,RELIQ_HNODE_SELFCLOSING},{"label",5,0},{"meter",5,0},
+  {"param",5,RELIQ_HNODE_SELFCLOSING},{"small",5,0},
+  {"style",5,RELIQ_HNODE_SCRIPT},{"table",5,0},
+  {"tbody",5,RELIQ_HNODE_AUTOCLOSING},{"tfoot",5,RELIQ_HNODE_AUTOCLOSING},
+  {"thead",5,RELIQ_HNODE_AUTOCLOSING},{"title",5,0},
+  {"track",5,RELIQ_HNODE_SELFCLOSING},{"video",5,0},{"applet",6,0},
+  {"button",6,0},{"canvas",6,0},{"center",6,0},{"dialog",6,0},{"figure",6,0},
+  {"footer",6,0},{"header",6,0},{"hgroup",6,0},{"iframe",6,0},
+  {"keygen",6,RELIQ_HNODE_SELFCLOSING},{"legend",6,0},{"object",6,0},
+  {"option",6,RELIQ_HNODE_AUTOCLOSING},{"output",6,0},
+  {"script",6,RELIQ_HNODE_SCRIPT},{"search",6,0},{"select",6,0},
+  {"source",6,RELIQ_HNODE_SELFCLOSING},{"strike",6,0},{"strong",6,0},
+  {"acronym",7,0},{"address",7,0},{"article",7,0},
+  {"caption",7,RELIQ_HNODE_AUTOCLOSING},{"command",7,RELIQ_HNODE_SELFCLOSING},
+  {"details",7,0},{"marquee",7,0},{"picture",7,0},{"section",7,0},
+  {"summary",7,0},{"basefont",8,0},{"colgroup",8,RELIQ_HNODE_AUTOCLOSING},
+  {"datalist",8,0},{"fieldset",8,0},{"frameset",8,0},
+  {"menuitem",8,RELIQ_HNODE_SELFCLOSING},{"noframes",8,0},{"noscript",8,0},
+  {"optgroup",8,RELIQ_HNODE_AUTOCLOSING},{"progress",8,0},{"template",8,0},
+  {"textarea",8,0},{"blockquote",10,0},{"figcaption",10,0}
 };
 
-#ifdef RELIQ_AUTOCLOSING
-const reliq_str8 autoclosing_s[] = { //tags that don't need to be closed
-  {"p",1},{"tr",2},{"td",2},{"th",2},{"tbody",5},
-  {"tfoot",5},{"thead",5},{"rt",2},{"rp",2},
-  {"caption",7},{"colgroup",8},{"option",6},{"optgroup",8}
+const uchar tags_hash[1024] = { //ids of tags_s indexed by tag_hash()
+  0,0,0,0,0,41,93,115,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,118,97,0,0,0,0,0,0,0,0,105,0,0,0,0,0,50,0,
+  63,0,0,0,0,0,0,0,0,129,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,123,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,21,
+  85,0,0,74,0,0,0,16,0,0,0,0,0,0,0,83,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,26,0,0,0,0,0,0,0,127,0,0,42,0,0,0,24,0,0,0,
+  7,0,0,0,0,0,0,0,0,67,0,77,0,0,0,0,0,43,0,1,32,0,0,0,
+  0,0,0,0,37,0,0,0,0,0,107,106,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,56,0,0,0,0,0,0,0,0,0,72,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,99,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,13,0,0,0,0,0,0,0,82,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,49,0,0,0,0,0,0,25,0,0,0,28,0,
+  0,120,0,0,114,0,0,0,52,70,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,9,0,2,89,0,0,0,29,0,84,0,0,0,0,125,131,0,0,0,0,95,0,
+  0,0,0,0,88,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  3,0,0,75,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,17,0,0,0,117,0,39,0,0,0,0,4,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,92,0,0,0,0,0,0,0,0,109,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  130,0,0,0,0,0,31,0,0,0,0,0,0,0,0,0,90,0,0,0,0,0,0,0,
+  0,68,0,0,0,0,0,0,44,0,0,0,0,0,0,126,0,0,0,0,0,0,57,0,
+  0,0,0,0,0,108,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,48,0,
+  0,60,0,0,0,0,0,0,122,0,0,0,0,0,0,0,14,0,0,0,0,0,0,0,
+  0,0,0,110,0,5,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,100,0,0,
+  0,8,0,45,0,0,0,0,0,0,0,46,0,0,0,0,0,87,0,0,0,0,10,0,
+  0,0,0,0,0,0,0,0,0,0,121,0,64,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,104,0,0,0,0,128,0,33,0,0,71,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,20,0,0,0,79,54,55,0,0,0,0,
+  0,76,0,0,119,124,0,0,0,0,0,0,0,0,18,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,27,0,0,0,0,0,58,0,0,0,0,0,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,0,0,0,0,0,0,12,0,38,30,0,0,0,62,0,0,0,0,0,0,0,0,0,
+  19,0,0,0,0,0,0,0,0,0,0,0,0,0,73,0,0,0,0,101,0,111,0,0,
+  0,0,103,0,0,53,0,0,0,0,0,0,0,0,0,0,0,69,0,0,0,0,0,0,
+  102,0,0,0,65,0,0,0,0,0,0,0,0,0,0,113,0,0,0,15,0,0,0,0,
+  0,0,0,34,22,0,0,81,66,0,0,51,0,0,0,0,0,0,0,0,0,0,6,86,
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,11,0,0,0,0,0,
+  0,0,0,59,0,0,0,0,0,0,0,61,0,0,0,0,0,0,0,0,36,0,0,0,
+  112,0,40,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,94,0,0,0,0,
+  0,0,0,0,0,0,0,98,0,0,0,0,0,0,0,0,0,0,0,0,0,0,80,0,
+  0,35,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+  0,96,23,0,0,0,0,0,0,0,0,0,0,0,0,78,0,0,0,0,91,0,0,0,
+  0,47,0,0,0,0,0,0,0,0,0,116,0,0,0,0
 };
-#endif
+
+static inline uint
+tag_hash(const char *name, const size_t namel)
+{
+  const uchar *n = (const uchar*)name;
+  uint64_t k = (uint64_t)n[0]|
+    (uint64_t)n[namel > 1]<<8|
+    (uint64_t)n[namel-1-(namel > 1)]<<16|
+    (uint64_t)n[namel-1]<<24|
+    (uint64_t)namel<<32;
+  return (k*0xb08c2cbcb3577755)>>54; //multiplier chosen so that tags_s have no collisions
+}
+
+ushort
+html_tag_id(const char *name, const size_t namel)
+{
+  if (!namel || namel > 10)
+    return 0;
+  uchar id = tags_hash[tag_hash(name,namel)];
+  if (!id || !memcomp(tags_s[id-1].b,name,tags_s[id-1].s,namel))
+    return 0;
+  return id;
+}
+
+static inline void
+tag_classify(const char *f, reliq_chnode *hnode)
+{
+  ushort id = html_tag_id(f+hnode->tag.b,hnode->tag.s);
+  hnode->tag_id = id;
+  if (!id)
+    return;
+  hnode->tag_flags = tags_s[id-1].flags;
+  #ifndef RELIQ_AUTOCLOSING
+  hnode->tag_flags &= ~RELIQ_HNODE_AUTOCLOSING;
+  #endif
+}
 
 static void
 comment_handle(const char *f, size_t *i, const size_t s)
@@ -64,80 +183,130 @@ comment_handle(const char *f, size_t *i, const size_t s)
   (*i)++;
   if (f[*i] == '-' && f[*i+1] == '-') {
     *i += 2;
-    while (s-*i > 2 && memcmp(f+*i,"-->",3) != 0)
-      (*i)++;
+    if (s-*i > 2) {
+      size_t end = scan_str(f,*i,s,"-->",3);
+      *i = (end < s) ? end : s-2;
+    }
     *i += 3;
-  } else {
-    while (*i < s && f[*i] != '>')
-      (*i)++;
+  } else if (*i < s) {
+    char const *end = memchr(f+*i,'>',s-*i);
+    *i = end ? (size_t)(end-f) : s;
   }
 }
 
 static void
-name_handle(const char *f, size_t *i, const size_t s, reliq_cstr *tag)
+name_handle(const char *f, size_t *i, const size_t s, reliq_span *tag)
 {
-    tag->b = f+*i;
+    tag->b = *i;
     while (*i < s && (isalnum(f[*i]) || f[*i] == '-' || f[*i] == '_' || f[*i] == ':'))
       (*i)++;
-    tag->s = (f+*i)-tag->b;
+    tag->s = *i-tag->b;
 }
 
+#ifdef RELIQ_AUTOCLOSING
+static inline uchar
+name_match(const char *f, const size_t i, const size_t s, const reliq_span *name)
+{
+  //same as comparing name to the one that name_handle() would get at i
+  if (i+name->s > s || memcmp(f+i,f+name->b,name->s) != 0)
+    return 0;
+  if (i+name->s == s)
+    return 1;
+  char c = f[i+name->s];
+  return !(isalnum(c) || c == '-' || c == '_' || c == ':');
+}
+#endif
+
 static void
 attrib_handle(const char *f, size_t *i, const size_t s, flexarr *attribs)
 {
-  reliq_cstr_pair *ac = (reliq_cstr_pair*)flexarr_inc(attribs);
+  reliq_span_pair t;
+  reliq_span_pair *ac = attribs ? (reliq_span_pair*)flexarr_inc(attribs) : &t;
   name_handle(f,i,s,&ac->f);
   while_is(isspace,f,*i,s);
   if (f[*i] != '=') {
-    ac->s.b = NULL;
+    ac->s.b = 0;
     ac->s.s = 0;
     return;
   }
   (*i)++;
   while_is(isspace,f,*i,s);
   if (f[*i] == '>') {
-    attribs->size--;
+    if (attribs)
+      attribs->size--;
     (*i)++;
     return;
   }
   if (f[*i] == '\'' || f[*i] == '"') {
     char delim = f[(*i)++];
-    ac->s.b = f+*i;
+    ac->s.b = *i;
     char *ending = memchr(f+*i,delim,s-*i);
     if (!ending) {
+      ac->s.s = s-*i;
       *i = s;
       return;
     }
     *i = ending-f;
-    ac->s.s = (f+*i)-ac->s.b;
+    ac->s.s = *i-ac->s.b;
     if (f[*i] == delim)
       (*i)++;
   } else {
-    ac->s.b = f+*i;
+    ac->s.b = *i;
     while (*i < s && !isspace(f[*i]) && f[*i] != '>')
       (*i)++;
-     ac->s.s = (f+*i)-ac->s.b;
+     ac->s.s = *i-ac->s.b;
   }
 }
 
+uchar
+html_attribs_handle(const char *f, size_t *i, const size_t s, flexarr *attribs)
+{
+  //adds attribs of start tag to attribs or only skips them if it's NULL, returns 1 if tag ends with '/'
+  if (!attribs) {
+    uchar slash;
+    *i = scan_attribs(f,*i,s,&slash);
+    return slash;
+  }
+  while (*i < s && f[*i] != '>') {
+    while_is(isspace,f,*i,s);
+    if (f[*i] == '/')
+      return 1;
+
+    if (!isalpha(f[*i])) {
+      if (f[*i] == '>')
+          break;
+      (*i)++;
+      continue;
+    }
+
+    while_is(isspace,f,*i,s);
+    attrib_handle(f,i,s,attribs);
+  }
+  return 0;
+}
+
 #ifdef RELIQ_PHPTAGS
 static void
-phptag_handle(const char *f, size_t *i, const size_t s, reliq_hnode *hnode)
+phptag_handle(const char *f, size_t *i, const size_t s, reliq_chnode *hnode)
 {
   (*i)++;
   while_is(isspace,f,*i,s);
   name_handle(f,i,s,&hnode->tag);
-  hnode->insides.b = f+*i;
+  hnode->tag_id = html_tag_id(f+hnode->tag.b,hnode->tag.s);
+  hnode->insides.b = *i;
   hnode->insides.s = 0;
 
   char *ending;
   for (; *i < s; (*i)++) {
+    *i = scan_chars(f,*i,s,"\\?\"'",4);
+    if (*i >= s)
+      break;
     if (f[*i] == '\\') {
       *i += 2;
       continue;
     }
     if (f[*i] == '?' && f[*i+1] == '>') {
-      hnode->insides.s = (*i)-1-(hnode->insides.b-f);
+      hnode->insides.s = (*i)-1-hnode->insides.b;
       (*i)++;
       break;
     }
@@ -174,32 +343,216 @@ phptag_handle(const char *f, size_t *i, const size_t s, reliq_hnode *hnode)
       }
     }
   }
-  hnode->all.s = (f+*i)-hnode->all.b+1;
+  hnode->all.s = *i-hnode->all.b+1;
 }
 #endif
 
+struct html_open_tag {
+  size_t index; //of node in nodes
+  size_t attrib_start; //end of start tag if attribs are lazy
+  uint64_t names; //bitset of hashed names of tags below it on the stack
+  size_t last; //index of its last child, 0 if it has none
+  uint count; //number of nodes in subtree
+  uchar foundend;
+};
+
+static inline uchar
+node_matchable(const reliq *rq, const reliq_chnode *hnode)
+{
+  //in fast mode nodes that can't be matched only have their structure parsed
+  if (rq->flags&RELIQ_SAVE)
+    return 1;
+  reliq_node const *expr = rq->expr;
+  return expr && hnode->lvl <= expr->lvl_max && (!expr->tag_id || hnode_match_tag(rq,hnode,expr));
+}
+
+static void
+node_link(reliq_chnode *nodes, const size_t index, struct html_open_tag *parent)
+{
+  //sets distances to parent and previous sibling of node at index
+  reliq_chnode *hnode = &nodes[index];
+  hnode->parent = 0;
+  hnode->prev = 0;
+  if (parent) {
+    hnode->parent = index-parent->index;
+    if (parent->last)
+      hnode->prev = index-parent->last;
+    parent->last = index;
+  } else if (index) {
+    //previous top level node is the one reached by going up from the node before it
+    size_t prev = index-1;
+    while (nodes[prev].parent)
+      prev -= nodes[prev].parent;
+    hnode->prev = index-prev;
+  }
+}
+
+static inline uint64_t
+name_bit(const char *f, const reliq_span *name)
+{
+  uint h = name->s;
+  for (size_t j = 0; j < name->s; j++)
+    h = h*31+(uchar)f[name->b+j];
+  return (uint64_t)1<<(h&63);
+}
+
+static inline uchar
+stack_has(const char *f, const flexarr *nodes, const flexarr *stack, const uint64_t names, const reliq_span *name)
+{
+  if (!(names&name_bit(f,name)))
+    return 0;
+  reliq_chnode *nodesv = (reliq_chnode*)nodes->v;
+  struct html_open_tag *stackv = (struct html_open_tag*)stack->v;
+  for (size_t j = 0; j < stack->size; j++)
+    if (spancomp(f,nodesv[stackv[j].index].tag,(*name)))
+      return 1;
+  return 0;
+}
+
+static uchar
+fragment_splice(const char *f, size_t *i, flexarr *nodes, flexarr *attribs, flexarr *stack, struct html_parallel *p, ulong *count)
+{
+  //adds nodes of siblings from fragments that begin at *i and would be parsed the same way here
+  struct html_fragments *fr = NULL;
+  struct html_sibling *siblings = NULL;
+  while (p->fragment < p->fragmentsl) {
+    fr = &p->fragments[p->fragment];
+    siblings = (struct html_sibling*)fr->siblings->v;
+    if (p->sibling >= fr->siblings->size) {
+      p->fragment++;
+      p->sibling = 0;
+      continue;
+    }
+    if (siblings[p->sibling].start >= *i)
+      break;
+    p->sibling++;
+  }
+  if (p->fragment >= p->fragmentsl || siblings[p->sibling].start != *i || !nodes->size)
+    return 0;
+
+  reliq_chnode *fnodes = (reliq_chnode*)fr->nodes->v;
+  reliq_span *closes = (reliq_span*)fr->closes->v;
+  reliq_chnode *parent = NULL;
+  uint64_t names = 0;
+  if (stack->size) {
+    struct html_open_tag *top = &((struct html_open_tag*)stack->v)[stack->size-1];
+    parent = &((reliq_chnode*)nodes->v)[top->index];
+    names = top->names|name_bit(f,&parent->tag);
+  }
+
+  size_t first = p->sibling,last = first;
+  while (last < fr->siblings->size) {
+    struct html_sibling *sib = &siblings[last];
+    if (!parent && last != first && sib->flags&HTML_SIBLING_COMMENT)
+      break; //comments are handled differently at the top level
+    #ifdef RELIQ_AUTOCLOSING
+    if (parent && parent->tag_flags&RELIQ_HNODE_AUTOCLOSING && spancomp(f,fnodes[sib->node].tag,parent->tag))
+      break;
+    #endif
+    size_t closesl = (last+1 < fr->siblings->size) ? siblings[last+1].closes : fr->closes->size;
+    for (size_t j = sib->closes; j < closesl; j++)
+      if (stack_has(f,nodes,stack,names,&closes[j]))
+        goto END;
+    last++;
+    if (sib->flags&HTML_SIBLING_LAST || (!parent && sib->flags&HTML_SIBLING_END_LT))
+      break;
+  }
+  END: ;
+  if (last == first)
+    return 0;
+
+  //child_count can't be used since nodes of unclosed tags may not be counted
+  size_t start = siblings[first].node;
+  size_t nodesl = siblings[last-1].node+siblings[last-1].nodesl-start;
+  flexarr_alloc(nodes,nodesl);
+  reliq_chnode *dest = (reliq_chnode*)nodes->v+nodes->size;
+  memcpy(dest,fnodes+start,nodesl*sizeof(reliq_chnode));
+  nodes->size += nodesl;
+
+  size_t shift = 0;
+  if (attribs) { //lazy attribs are positions in data that don't change
+    size_t astart = siblings[first].attribs;
+    size_t attribsl = siblings[last-1].attribs+siblings[last-1].attribsl-astart;
+    if (attribsl) {
+      flexarr_alloc(attribs,attribsl);
+      memcpy(attribs->v+(attribs->size*attribs->elsize),fr->attribs->v+(astart*attribs->elsize),attribsl*attribs->elsize);
+    }
+    shift = attribs->size-astart;
+    attribs->size += attribsl;
+  }
+
+  struct html_open_tag *top = stack->size ? &((struct html_open_tag*)stack->v)[stack->size-1] : NULL;
+  for (size_t j = 0; j < nodesl; j++) {
+    dest[j].lvl += stack->size;
+    dest[j].attribs += shift;
+    if (dest[j].lvl == stack->size) //siblings were parsed without ancestors
+      node_link((reliq_chnode*)nodes->v,nodes->size-nodesl+j,top);
+  }
+  *count = 0;
+  for (size_t j = first; j < last; j++)
+    *count += siblings[j].count;
+
+  *i = siblings[last-1].end;
+  p->sibling = last;
+  return 1;
+}
+
 ulong
 html_struct_handle(const char *f, size_t *i, const size_t s, const ushort lvl, flexarr *nodes, reliq *rq, reliq_error **err)
 {
   *err = NULL;
-  ulong ret = 1;
-  reliq_hnode *hnode = flexarr_inc(nodes);
-  memset(hnode,0,sizeof(reliq_hnode));
-  hnode->lvl = lvl;
-  size_t index = nodes->size-1;
-  flexarr *a = (flexarr*)rq->attrib_buffer;
-  size_t attrib_start = a->size;
-  uchar foundend = 1;
-
-  hnode->all.b = f+*i;
+  ulong ret = 0; //passed from closed tag to its parent, child count in lower and unwind depth in higher 32 bits
+  ulong unwind = 0;
+  flexarr *a = (flexarr*)rq->attrib_buffer; //NULL if attribs are lazy or not needed
+  flexarr *stack = flexarr_init(sizeof(struct html_open_tag),HTML_STACK_INC);
+  struct html_open_tag *tag;
+  reliq_chnode *hnode;
+  size_t tagend;
+  size_t edge = 0; //furthest position that was read, if it's at s parsing depended on the end of data
+  //in fast mode nodes are matched without their siblings
+  uchar links = (rq->flags&RELIQ_SAVE || !rq->expr || rq->expr->needs&RELIQ_NEEDS_SIBLINGS);
+
+  #define edge_set(x) if ((x) > edge) \
+    edge = (x)
+
+  OPEN: ;
+  if (rq->parallel && ((struct html_parallel*)rq->parallel)->fragmentsl) {
+    ulong count;
+    if (fragment_splice(f,i,nodes,a,stack,(struct html_parallel*)rq->parallel,&count)) {
+      if (!stack->size) {
+        flexarr_free(stack);
+        return count;
+      }
+      tag = &((struct html_open_tag*)stack->v)[stack->size-1];
+      hnode = &((reliq_chnode*)nodes->v)[tag->index];
+      tag->count += count;
+      goto NEXT;
+    }
+  }
+
+  hnode = flexarr_inc(nodes);
+  memset(hnode,0,sizeof(reliq_chnode));
+  hnode->lvl = lvl+stack->size;
+  tag = flexarr_inc(stack);
+  memset(tag,0,sizeof(struct html_open_tag));
+  tag->index = nodes->size-1;
+  tag->attrib_start = a ? a->size : *i;
+  tag->count = 1;
+  tag->foundend = 1;
+
+  hnode->all.b = *i;
   hnode->all.s = 0;
   (*i)++;
   while_is(isspace,f,*i,s);
   if (f[*i] == '!') {
     comment_handle(f,i,s);
     flexarr_dec(nodes);
-    return 0;
+    flexarr_dec(stack);
+    ret = 0;
+    goto CLOSED;
   }
+  if (links)
+    node_link((reliq_chnode*)nodes->v,tag->index,(stack->size > 1) ? tag-1 : NULL);
 
   #ifdef RELIQ_PHPTAGS
   if (f[*i] == '?') {
@@ -209,165 +562,289 @@ html_struct_handle(const char *f, size_t *i, const size_t s, const ushort lvl, f
   #endif
 
   name_handle(f,i,s,&hnode->tag);
-  for (; *i < s && f[*i] != '>';) {
-    while_is(isspace,f,*i,s);
-    if (f[*i] == '/') {
-      char *r = memchr(f+*i,'>',s-*i);
-      if (r != NULL)
-        hnode->all.s = r-hnode->all.b+1;
-      goto END;
-    }
-
-    if (!isalpha(f[*i])) {
-      if (f[*i] == '>')
-          break;
-      (*i)++;
-      continue;
-    }
-
-    while_is(isspace,f,*i,s);
-    attrib_handle(f,i,s,a);
+  tag_classify(f,hnode);
+  if (stack->size > 1) {
+    struct html_open_tag *parent = tag-1;
+    tag->names = parent->names|name_bit(f,&((reliq_chnode*)nodes->v)[parent->index].tag);
   }
-
-  #define search_array(x,y) for (uint _j = 0; _j < (uint)LENGTH(x); _j++) \
-    if (strcomp(x[_j],y))
-
-  search_array(selfclosing_s,hnode->tag) {
-    hnode->all.s = f+*i-hnode->all.b+1;
+  uchar slash = html_attribs_handle(f,i,s,node_matchable(rq,hnode) ? a : NULL);
+  if (a) {
+    hnode->attribsl = a->size-tag->attrib_start;
+  } else
+    tag->attrib_start = *i;
+  if (slash) {
+    char *r = memchr(f+*i,'>',s-*i);
+    if (r != NULL) {
+      hnode->all.s = (r-f)-hnode->all.b+1;
+    } else
+      edge_set(s);
     goto END;
   }
 
-  uchar script = 0;
-  search_array(script_s,hnode->tag) {
-    script = 1;
-    break;
-  }
-
-  #ifdef RELIQ_AUTOCLOSING
-  uchar autoclosing = 0;
-  search_array(autoclosing_s,hnode->tag) {
-    autoclosing = 1;
-    break;
+  if (hnode->tag_flags&RELIQ_HNODE_SELFCLOSING) {
+    hnode->all.s = *i-hnode->all.b+1;
+    goto END;
   }
-  #endif
 
   (*i)++;
-  hnode->insides.b = f+*i;
+  hnode->insides.b = *i;
   hnode->insides.s = *i;
-  size_t tagend;
+
   while (*i < s) {
-    if (f[*i] == '<') {
-      tagend=*i;
+    if (f[*i] != '<') {
+      //in scripts only end tags matter
+      *i = (hnode->tag_flags&RELIQ_HNODE_SCRIPT) ? scan_endtag(f,*i,s) : sindex_next((struct sindex*)rq->sindex,f,*i,s,'<');
+      continue;
+    }
+    tagend=*i;
+    (*i)++;
+    while_is(isspace,f,*i,s);
+    if (f[*i] == '/') {
       (*i)++;
       while_is(isspace,f,*i,s);
-      if (f[*i] == '/') {
-        (*i)++;
-        while_is(isspace,f,*i,s);
-
-        if (*i+hnode->tag.s < s && memcmp(hnode->tag.b,f+*i,hnode->tag.s) == 0) {
-          hnode->insides.s = tagend-hnode->insides.s;
-          *i += hnode->tag.s;
-          char *ending = memchr(f+*i,'>',s-*i);
-          if (!ending) {
-            *i = s;
-            flexarr_dec(nodes);
-            return 0;
-          }
-          *i = ending-f;
-          hnode->all.s = (f+*i+1)-hnode->all.b;
-          goto END;
-        }
 
-        if (!index) {
-          foundend = 0;
-          continue;
+      edge_set(*i+hnode->tag.s);
+      if (*i+hnode->tag.s < s && memcmp(f+hnode->tag.b,f+*i,hnode->tag.s) == 0) {
+        hnode->insides.s = tagend-hnode->insides.s;
+        *i += hnode->tag.s;
+        char *ending = memchr(f+*i,'>',s-*i);
+        if (!ending) {
+          *i = s;
+          hnode->attribs = a ? tag->attrib_start : hnode->tag.b; //attribs are dropped
+          hnode->attribsl = 0;
+          reliq_chnode *nodesv = (reliq_chnode*)nodes->v;
+          if (tag->index == nodes->size-1) { //it's the node that gets removed
+            if (stack->size > 1)
+              (tag-1)->last = hnode->prev ? tag->index-hnode->prev : 0;
+          } else for (size_t j = nodes->size-1-nodesv[nodes->size-1].parent; j != tag->index; j -= nodesv[j].parent)
+            nodesv[j].child_count--; //its last descendant gets removed instead
+          flexarr_dec(nodes);
+          flexarr_dec(stack);
+          ret = 0;
+          goto CLOSED;
         }
+        *i = ending-f;
+        hnode->all.s = *i+1-hnode->all.b;
+        goto END;
+      }
 
-        reliq_cstr endname;
-        reliq_hnode *nodesv = (reliq_hnode*)nodes->v;
-        name_handle(f,i,s,&endname);
-        if (!endname.s) {
-          (*i)++;
-          continue;
-        }
-        for (size_t j = index-1;; j--) {
-          if (nodesv[j].all.s || nodesv[j].lvl >= lvl) {
-            if (!j)
-              break;
-            continue;
-          }
-          if (strcomp(nodesv[j].tag,endname)) {
-            *i = tagend;
-            hnode->insides.s = *i-hnode->insides.s;
-            ret = (ret&0xffffffff)+((ulong)(lvl-nodesv[j].lvl-1)<<32);
-            goto END;
-          }
-          if (!j || !nodesv[j].lvl)
-            break;
-        }
-      } else if (!script) {
-        if (f[*i] == '!') {
-          (*i)++;
-          comment_handle(f,i,s);
-          continue;
-        } else {
-          #ifdef RELIQ_AUTOCLOSING
-          if (autoclosing) {
-            reliq_cstr name;
-
-            while_is(isspace,f,*i,s);
-            name_handle(f,i,s,&name);
-
-            if (strcomp(hnode->tag,name)) {
-              *i = tagend-1;
-              hnode->insides.s = *i-hnode->insides.s+1;
-              hnode->all.s = (f+*i+1)-hnode->all.b;
-              goto END;
-            }
-          }
-          #endif
+      if (!tag->index) {
+        tag->foundend = 0;
+        continue;
+      }
+
+      reliq_span endname;
+      name_handle(f,i,s,&endname);
+      if (!endname.s) {
+        (*i)++;
+        continue;
+      }
+
+      //tags that are still open are only on the stack so there is no need to go through nodes
+      if (!(tag->names&name_bit(f,&endname)))
+        goto UNMATCHED;
+      reliq_chnode *nodesv = (reliq_chnode*)nodes->v;
+      struct html_open_tag *stackv = (struct html_open_tag*)stack->v;
+      for (size_t j = stack->size-1; j > 0; j--) {
+        reliq_chnode *ancestor = &nodesv[stackv[j-1].index];
+        if (spancomp(f,ancestor->tag,endname)) {
+          edge_set(*i);
           *i = tagend;
-          ulong rettmp = html_struct_handle(f,i,s,lvl+1,nodes,rq,err);
-          if (*err)
-            goto END;
-          ret += rettmp&0xffffffff;
-          hnode = &((reliq_hnode*)nodes->v)[index];
-          if (rettmp>>32) {
-            (*i)--;
+          hnode->insides.s = *i-hnode->insides.s;
+          unwind = stack->size-j-1;
+          goto END;
+        }
+        if (!ancestor->lvl)
+          break;
+      }
+
+      UNMATCHED: ;
+      if (rq->parallel && ((struct html_parallel*)rq->parallel)->closes) //it might match ancestors of fragment
+        *(reliq_span*)flexarr_inc(((struct html_parallel*)rq->parallel)->closes) = endname;
+    } else if (!(hnode->tag_flags&RELIQ_HNODE_SCRIPT)) {
+      if (f[*i] == '!') {
+        (*i)++;
+        comment_handle(f,i,s);
+        continue;
+      } else {
+        #ifdef RELIQ_AUTOCLOSING
+        if (hnode->tag_flags&RELIQ_HNODE_AUTOCLOSING) {
+          while_is(isspace,f,*i,s);
+          edge_set(*i+hnode->tag.s);
+          if (name_match(f,*i,s,&hnode->tag)) {
+            *i = tagend-1;
             hnode->insides.s = *i-hnode->insides.s+1;
-            hnode->all.s = (f+*i+1)-hnode->all.b;
-            ret |= ((rettmp>>32)-1)<<32;
+            hnode->all.s = *i+1-hnode->all.b;
             goto END;
           }
-          ret |= rettmp&0xffffffff00000000;
         }
+        #endif
+        edge_set(*i);
+        *i = tagend;
+        goto OPEN;
       }
     }
+    NEXT: ;
     (*i)++;
   }
+  //tag wasn't closed so its insides reach the end
+  hnode->insides.s = (s > hnode->insides.s) ? s-hnode->insides.s : 0;
 
   END: ;
+  edge_set(*i);
   if (*i >= s) {
-    hnode->all.s = s-(hnode->all.b-f)-1;
+    hnode->all.s = s-hnode->all.b-1;
   } else if (!hnode->all.s)
-    hnode->all.s = f+*i-hnode->all.b;
-  if (!foundend)
-    hnode->insides.s = hnode->all.s;
-
-  size_t size = a->size-attrib_start;
-  hnode->attribsl = size;
-  hnode->child_count = ret-1;
-  if (rq->flags&RELIQ_SAVE) {
-    hnode->attribs = size ?
-        memdup(a->v+(attrib_start*a->elsize),size*a->elsize)
-        : NULL;
-  } else {
-    hnode->attribs = a->v+(attrib_start*a->elsize);
+    hnode->all.s = *i-hnode->all.b;
+  if (!tag->foundend) //insides reach the end of node
+    hnode->insides.s = (hnode->all.b+hnode->all.s > hnode->insides.b) ? hnode->all.b+hnode->all.s-hnode->insides.b : 0;
+
+  hnode->child_count = tag->count-1;
+  hnode->attribs = tag->attrib_start;
+  if (!(rq->flags&RELIQ_SAVE)) {
+    if (a)
+      rq->attribs = (reliq_span_pair*)a->v; //buffer could be reallocated
     reliq_node const *expr = rq->expr;
-    if (expr && reliq_match(hnode,NULL,expr))
-      *err = node_output(hnode,NULL,rq->nodef,rq->nodefl,rq->output,rq);
+    if (expr && hnode->lvl <= expr->lvl_max && hnode_match(rq,hnode,NULL,expr)) {
+      if (!(rq->flags&RELIQ_STREAM)) {
+        *err = node_output(hnode,NULL,rq->nodef,rq->nodefl,rq->output,rq);
+      } else {
+        //node is certain only if its parsing didn't depend on the end of data, nodes that were written by previous tries are skipped
+        reliq_stream *stream = (reliq_stream*)rq;
+        if ((edge < s || stream->end) && stream->matched++ == stream->written) {
+          stream->written++;
+          *err = node_output(hnode,NULL,rq->nodef,rq->nodefl,rq->output,rq);
+        }
+      }
+    }
     flexarr_dec(nodes);
+    if (a)
+      a->size = tag->attrib_start;
+  }
+  ret = tag->count+(unwind<<32);
+  unwind = 0;
+  flexarr_dec(stack);
+
+  CLOSED: ;
+  if (!stack->size) {
+    flexarr_free(stack);
+    edge_set(*i);
+    if (rq->flags&RELIQ_STREAM && edge >= s)
+      ((reliq_stream*)rq)->edge = 1;
+    return ret;
   }
-  a->size = attrib_start;
-  return ret;
+  tag = &((struct html_open_tag*)stack->v)[stack->size-1];
+  hnode = &((reliq_chnode*)nodes->v)[tag->index];
+  if (*err)
+    goto END;
+  tag->count += ret&0xffffffff;
+  if (ret>>32) {
+    (*i)--;
+    hnode->insides.s = *i-hnode->insides.s+1;
+    hnode->all.s = *i+1-hnode->all.b;
+    unwind = (ret>>32)-1;
+    goto END;
+  }
+  goto NEXT;
+}
+
+void
+html_fragments_parse(const char *f, const size_t start, const size_t end, void *sindex, const uchar flags, struct html_fragments *fr)
+{
+  fr->nodes = flexarr_init(sizeof(reliq_chnode),HTML_NODES_INC);
+  flexarr_set(fr->nodes,sindex_count((struct sindex*)sindex,start,end)+1);
+  fr->siblings = flexarr_init(sizeof(struct html_sibling),HTML_STACK_INC);
+  fr->closes = flexarr_init(sizeof(reliq_span),HTML_STACK_INC);
+  //node at 0 is only the first one in the whole document
+  memset(flexarr_inc(fr->nodes),0,sizeof(reliq_chnode));
+
+  struct html_parallel p;
+  memset(&p,0,sizeof(p));
+  p.closes = fr->closes;
+  //data ends at end, stream tells if sibling's parsing depended on it, in which case it's discarded
+  reliq_stream stream;
+  memset(&stream,0,sizeof(stream));
+  reliq *rq = &stream.rq;
+  rq->data = f;
+  rq->flags = RELIQ_SAVE|RELIQ_STREAM|flags;
+  rq->sindex = sindex;
+  rq->parallel = &p;
+  fr->attribs = flexarr_init(sizeof(reliq_span_pair),HTML_ATTRIBS_INC);
+  rq->attrib_buffer = (flags&RELIQ_ATTRIBS_LAZY) ? NULL : (void*)fr->attribs;
+  reliq_error *err;
+
+  size_t i = start;
+  while (i < end) {
+    //siblings most likely follow closing tags
+    char const *r = memmem(f+i,end-i,"</",2);
+    if (!r)
+      break;
+    r = memchr(r,'>',end-(r-f));
+    if (!r)
+      break;
+    i = sindex_next((struct sindex*)sindex,f,r-f,end,'<');
+
+    size_t siblingsl = fr->siblings->size;
+    uchar comment = 0;
+    while (i < end) {
+      if (f[i] != '<') {
+        i = sindex_next((struct sindex*)sindex,f,i,end,'<');
+        continue;
+      }
+      //same as in loop of html_struct_handle()
+      size_t tagend = i;
+      i++;
+      while_is(isspace,f,i,end);
+      if (i >= end)
+        break;
+      if (f[i] == '/') {
+        i = tagend; //closing tag of their parent may be followed by its siblings
+        break;
+      }
+      if (f[i] == '!') {
+        i++;
+        comment_handle(f,&i,end);
+        comment = 1;
+        continue;
+      }
+
+      struct html_sibling *sib = (struct html_sibling*)flexarr_inc(fr->siblings);
+      sib->start = tagend;
+      sib->node = fr->nodes->size;
+      sib->closes = fr->closes->size;
+      sib->attribs = fr->attribs->size;
+      sib->flags = comment ? HTML_SIBLING_COMMENT : 0;
+      comment = 0;
+
+      i = tagend;
+      stream.edge = 0;
+      sib->count = html_struct_handle(f,&i,end,0,fr->nodes,rq,&err)&0xffffffff;
+      sib->nodesl = fr->nodes->size-sib->node;
+      sib->attribsl = fr->attribs->size-sib->attribs;
+      if (stream.edge) {
+        //it didn't end in part, siblings will be searched inside of it
+        fr->nodes->size = sib->node;
+        fr->closes->size = sib->closes;
+        fr->attribs->size = sib->attribs;
+        fr->siblings->size--;
+        i = tagend+1;
+        break;
+      }
+      sib->end = i;
+      if (f[i] == '<')
+        sib->flags |= HTML_SIBLING_END_LT;
+      i++;
+    }
+    if (fr->siblings->size > siblingsl)
+      ((struct html_sibling*)fr->siblings->v)[fr->siblings->size-1].flags |= HTML_SIBLING_LAST;
+  }
+}
+
+void
+html_fragments_free(struct html_fragments *fr)
+{
+  flexarr_free(fr->nodes);
+  flexarr_free(fr->attribs);
+  flexarr_free(fr->siblings);
+  flexarr_free(fr->closes);
 }
@@ -19,6 +19,41 @@
 #ifndef OUTPUT_H
 #define OUTPUT_H
 
+#define HTML_SIBLING_COMMENT 0x1 //comment is between it and previous sibling
+#define HTML_SIBLING_END_LT 0x2 //parsing of it ended at '<'
+#define HTML_SIBLING_LAST 0x4 //last sibling of fragment
+
+struct html_sibling {
+  size_t start; //position of its '<'
+  size_t end; //position at which its parsing ended
+  size_t node; //index of its node in nodes of fragments
+  size_t nodesl; //number of nodes it added
+  unsigned long count; //number of nodes passed to its parent
+  size_t attribs; //index of its first attrib in attribs of fragments
+  size_t attribsl; //number of attribs it added
+  size_t closes; //index of its first unmatched closing tag
+  unsigned char flags;
+};
+
+struct html_fragments { //runs of siblings parsed without knowing their ancestors
+  flexarr *nodes; //reliq_chnode
+  flexarr *siblings; //struct html_sibling
+  flexarr *closes; //reliq_span, names of closing tags that weren't matched inside of fragment
+  flexarr *attribs; //reliq_span_pair
+};
+
+struct html_parallel {
+  struct html_fragments *fragments;
+  size_t fragmentsl;
+  size_t fragment; //position of the next sibling that may be used
+  size_t sibling;
+  flexarr *closes; //set when parsing fragments
+};
+
+unsigned short html_tag_id(const char *name, const size_t namel);
+unsigned char html_attribs_handle(const char *f, size_t *i, const size_t s, flexarr *attribs);
+void html_fragments_parse(const char *f, const size_t start, const size_t end, void *sindex, const unsigned char flags, struct html_fragments *fr);
+void html_fragments_free(struct html_fragments *fr);
 unsigned long html_struct_handle(const char *f, size_t *i, const size_t s, const ushort lvl, flexarr *nodes, reliq *rq, reliq_error **err);
 
 #endif
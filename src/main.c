@@ -27,6 +27,7 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <sys/mman.h>
 #include <regex.h>
@@ -44,6 +45,10 @@
 
 #define F_RECURSIVE 0x1
 #define F_FAST 0x2
+#define F_INDEX 0x4
+#define F_ORDER 0x8
+
+#define INDEX_EXT ".rqidx"
 
 #define BUFF_INC_VALUE (1<<23)
 
@@ -53,9 +58,13 @@ typedef unsigned int uint;
 typedef unsigned long int ulong;
 
 char *argv0;
-reliq_exprs exprs = {0};
+reliq_exprs *exprs = NULL; //PATTERNS of every -f, searched separately
+FILE **outfiles = NULL; //outputs of exprs, NULL if it's outfile
+size_t exprsl = 0;
+char *bundlepath = NULL;
 
 uint settings = 0;
+uint threads = 1;
 int nftwflags = FTW_PHYS;
 FILE *outfile;
 FILE *errfile;
@@ -102,6 +111,40 @@ xerr(int eval, const char *s, ...) {
   exit(eval);
 }
 
+static reliq_exprs *
+exprs_add()
+{
+  exprs = realloc(exprs,(exprsl+1)*sizeof(reliq_exprs));
+  outfiles = realloc(outfiles,(exprsl+1)*sizeof(FILE*));
+  memset(&exprs[exprsl],0,sizeof(reliq_exprs));
+  outfiles[exprsl] = NULL;
+  return &exprs[exprsl++];
+}
+
+static void
+exprs_free()
+{
+  for (size_t i = 0; i < exprsl; i++) {
+    reliq_efree(&exprs[i]);
+    if (outfiles[i] && outfiles[i] != outfile)
+      fclose(outfiles[i]);
+  }
+  free(exprs);
+  free(outfiles);
+  exprs = NULL;
+  outfiles = NULL;
+  exprsl = 0;
+}
+
+static uchar
+exprs_needs()
+{
+  uchar needs = 0;
+  for (size_t i = 0; i < exprsl; i++)
+    needs |= exprs[i].needs;
+  return needs;
+}
+
 static void
 handle_reliq_error(reliq_error *err) {
   if (err == NULL)
@@ -126,16 +169,20 @@ usage()
       "Example: %s 'div id; a href=e>\".org\"' index.html\n\n"\
       "Options:\n"\
       "  -l\t\t\tlist structure of FILE\n"\
-      "  -o FILE\t\tchange output to a FILE instead of stdout\n"\
+      "  -p\t\t\tprint order in which conditions of nodes are checked, and exit\n"\
+      "  -o FILE\t\tchange output to a FILE instead of stdout, if given after -f only of its PATTERNS\n"\
       "  -e FILE\t\tchange output of errors to a FILE instead of stderr\n"\
-      "  -f FILE\t\tobtain PATTERNS from FILE\n"\
+      "  -f FILE\t\tobtain PATTERNS from FILE, if given many times each PATTERNS are searched separately\n"\
+      "  -c FILE\t\tsave compiled PATTERNS to FILE that can be given to -f, and exit\n"\
       "  -H\t\t\tfollow symlinks\n"\
       "  -r\t\t\tread all files under each directory, recursively\n"\
       "  -R\t\t\tlikewise but follow all symlinks\n"\
       "  -F\t\t\tenter fast and low memory consumption mode\n"\
+      "  -j NUM\t\tparse and search FILE using NUM threads\n"\
+      "  -i\t\t\tuse index from FILE%s, save it there if it doesn't match FILE\n"\
       "  -h\t\t\tshow help\n"\
       "  -v\t\t\tshow version\n\n"\
-      "When FILE isn't specified, FILE will become standard input.",argv0,argv0,argv0);
+      "When FILE isn't specified, FILE will become standard input.",argv0,argv0,INDEX_EXT,argv0);
 }
 
 static int
@@ -145,8 +192,62 @@ unalloc_free(void *ptr, size_t size)
   return 0;
 }
 
+static uchar
+index_load(const char *path, const char *f, const size_t s, reliq *rq, char **idx, size_t *idxl)
+{
+  //returns 1 if index at path was made for f
+  int fd = open(path,O_RDONLY);
+  if (fd == -1)
+    return 0;
+  struct stat st;
+  if (fstat(fd,&st) == -1 || !st.st_size) {
+    close(fd);
+    return 0;
+  }
+  char *file = mmap(NULL,st.st_size,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+  close(fd);
+  if (file == MAP_FAILED)
+    return 0;
+
+  reliq_error *err = reliq_load_index(f,s,file,st.st_size,rq);
+  if (err) {
+    free(err);
+    munmap(file,st.st_size);
+    return 0;
+  }
+  *idx = file;
+  *idxl = st.st_size;
+  return 1;
+}
+
 static void
-expr_exec(char *f, size_t s, const uchar inpipe)
+index_save(const char *path, const reliq *rq)
+{
+  //it's written to temporary file first so that other processes never read it partially
+  char tmp[PATH_MAX];
+  if (snprintf(tmp,PATH_MAX,"%s.%d",path,(int)getpid()) >= PATH_MAX)
+    return;
+  FILE *file = fopen(tmp,"w");
+  if (file == NULL) {
+    xwarn("%s",tmp);
+    return;
+  }
+  reliq_error *err = reliq_save_index(rq,file);
+  fclose(file);
+  if (err) {
+    fprintf(errfile,"%s: %s: %s\n",argv0,path,err->msg);
+    free(err);
+    unlink(tmp);
+    return;
+  }
+  if (rename(tmp,path) == -1) {
+    xwarn("%s",path);
+    unlink(tmp);
+  }
+}
+
+static void
+expr_exec(char *f, size_t s, const uchar inpipe, const char *path)
 {
   if (f == NULL || s == 0)
     return;
@@ -154,16 +255,31 @@ expr_exec(char *f, size_t s, const uchar inpipe)
   reliq_error *err;
 
   if (settings&F_FAST) {
-    err = reliq_fexec_file(f,s,outfile,&exprs,inpipe ? unalloc_free : munmap);
+    err = reliq_fexec_file(f,s,outfiles[0],exprs,inpipe ? unalloc_free : munmap);
     if (err)
       goto ERR;
     return;
   }
 
-  reliq rq = reliq_init(f,s);
-  err = reliq_exec_file(&rq,outfile,&exprs);
+  reliq rq;
+  char *idx = NULL;
+  size_t idxl = 0;
+  char indexpath[PATH_MAX];
+  if (settings&F_INDEX && path && snprintf(indexpath,PATH_MAX,"%s%s",path,INDEX_EXT) < PATH_MAX) {
+    if (!index_load(indexpath,f,s,&rq,&idx,&idxl)) {
+      //saved index has to have attribs for any expression
+      rq = reliq_init_parallel(f,s,threads);
+      index_save(indexpath,&rq);
+    }
+  } else //attribs are tokenized at parsing only if expressions need them
+    rq = (exprs_needs()&RELIQ_NEEDS_ATTRIBS) ? reliq_init_parallel(f,s,threads) : reliq_init_lazy(f,s,threads);
+  rq.threads = threads;
+  //first nodes of all PATTERNS are matched in a single pass
+  err = reliq_exec_files(&rq,outfiles,exprs,exprsl);
 
   reliq_free(&rq);
+  if (idx)
+    munmap(idx,idxl);
   ERR: ;
   if (inpipe) {
     free(f);
@@ -171,7 +287,7 @@ expr_exec(char *f, size_t s, const uchar inpipe)
     munmap(f,s);
 
   if (err) {
-    reliq_efree(&exprs);
+    exprs_free();
     handle_reliq_error(err);
   }
 }
@@ -191,6 +307,36 @@ pipe_to_str(int fd, char **file, size_t *size)
   *file = realloc(*file,*size);
 }
 
+static void
+pipe_to_stream(int fd)
+{
+  reliq_stream stream;
+  reliq_error *err = reliq_stream_init(&stream,outfiles[0],exprs);
+  if (err)
+    goto ERR;
+
+  char *buffer = malloc(BUFF_INC_VALUE);
+  ssize_t readbytes;
+  while ((readbytes = read(fd,buffer,BUFF_INC_VALUE)) > 0) {
+    if ((err = reliq_stream_feed(&stream,buffer,readbytes)))
+      break;
+    fflush(outfile);
+  }
+  free(buffer);
+
+  reliq_error *ferr = reliq_stream_finish(&stream);
+  if (!err) {
+    err = ferr;
+  } else if (ferr)
+    free(ferr);
+
+  ERR: ;
+  if (err) {
+    exprs_free();
+    handle_reliq_error(err);
+  }
+}
+
 void
 file_handle(const char *f)
 {
@@ -199,9 +345,13 @@ file_handle(const char *f)
   char *file;
 
   if (f == NULL) {
+    if (settings&F_FAST) {
+      pipe_to_stream(0);
+      return;
+    }
     size_t size;
     pipe_to_str(0,&file,&size);
-    expr_exec(file,size,1);
+    expr_exec(file,size,1,NULL);
     return;
   }
 
@@ -232,7 +382,7 @@ file_handle(const char *f)
     close(fd);
   } else {
     close(fd);
-    expr_exec(file,st.st_size,0);
+    expr_exec(file,st.st_size,0,f);
   }
 }
 
@@ -248,16 +398,40 @@ load_expr_from_file(char *filename)
   size_t filel;
   pipe_to_str(fd,&file,&filel);
   close(fd);
-  reliq_error *err = reliq_ecomp(file,filel,&exprs);
+  reliq_error *err;
+  reliq_exprs *e = exprs_add();
+  if (filel >= sizeof(RELIQ_BUNDLE_MAGIC)-1 && memcmp(file,RELIQ_BUNDLE_MAGIC,sizeof(RELIQ_BUNDLE_MAGIC)-1) == 0) {
+    err = reliq_eload(file,filel,e);
+  } else
+    err = reliq_ecomp(file,filel,e);
   free(file);
   handle_reliq_error(err);
 }
 
+static void
+save_bundle(const char *path)
+{
+  FILE *file = fopen(path,"w");
+  if (file == NULL)
+    xerr(1,"%s",path);
+  reliq_error *err = reliq_esave(exprs,file);
+  fclose(file);
+  if (err) {
+    unlink(path);
+    exprs_free();
+    handle_reliq_error(err);
+  }
+}
+
 int
 nftw_func(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
 {
-  if (typeflag == FTW_F || typeflag == FTW_SL)
-    file_handle(fpath);
+  if (typeflag != FTW_F && typeflag != FTW_SL)
+    return 0;
+  size_t pathl = strlen(fpath);
+  if (settings&F_INDEX && pathl >= sizeof(INDEX_EXT)-1 && strcmp(fpath+pathl-sizeof(INDEX_EXT)+1,INDEX_EXT) == 0)
+    return 0; //indexes of other files
+  file_handle(fpath);
 
   return 0;
 }
@@ -273,15 +447,20 @@ main(int argc, char **argv)
   if (argc < 2)
     usage();
 
-  while ((opt = getopt(argc,argv,"lo:e:f:HrRFvh")) != -1) {
+  while ((opt = getopt(argc,argv,"lo:e:f:c:j:ipHrRFvh")) != -1) {
     switch (opt) {
       case 'l':
-        handle_reliq_error(reliq_ecomp("| \"%n%A - children(%c) lvl(%L) size(%s) pos(%p)\\n\"",50,&exprs));
+        handle_reliq_error(reliq_ecomp("| \"%n%A - children(%c) lvl(%L) size(%s) pos(%p)\\n\"",50,exprs_add()));
         break;
-      case 'o':
-        outfile = fopen(optarg,"w");
-        if (outfile == NULL)
+      case 'o': {
+        FILE *o = fopen(optarg,"w");
+        if (o == NULL)
           xerr(1,"%s",optarg);
+        FILE **prev = exprsl ? &outfiles[exprsl-1] : &outfile; //output of last -f
+        if (*prev && *prev != stdout)
+          fclose(*prev);
+        *prev = o;
+        }
         break;
       case 'e':
         errfile = fopen(optarg,"w");
@@ -291,6 +470,17 @@ main(int argc, char **argv)
         }
         break;
       case 'f': load_expr_from_file(optarg); break;
+      case 'c': bundlepath = optarg; break;
+      case 'j': {
+        char *end;
+        long n = strtol(optarg,&end,10);
+        if (end == optarg || *end || n < 1 || n > UINT_MAX)
+          die("%s: invalid number of threads: %s",argv0,optarg);
+        threads = n;
+        }
+        break;
+      case 'i': settings |= F_INDEX; break;
+      case 'p': settings |= F_ORDER; break;
       case 'H': nftwflags &= ~FTW_PHYS; break;
       case 'r': settings |= F_RECURSIVE; break;
       case 'R': settings |= F_RECURSIVE; nftwflags &= ~FTW_PHYS; break;
@@ -301,21 +491,39 @@ main(int argc, char **argv)
     }
   }
 
-  if (!exprs.b && optind < argc) {
-    handle_reliq_error(reliq_ecomp(argv[optind],strlen(argv[optind]),&exprs));
+  if (!exprsl && optind < argc) {
+    handle_reliq_error(reliq_ecomp(argv[optind],strlen(argv[optind]),exprs_add()));
     optind++;
   }
-  if (!exprs.b)
+  if (!exprsl)
       return -1;
+  for (size_t i = 0; i < exprsl; i++)
+    if (!outfiles[i])
+      outfiles[i] = outfile;
+  if (exprsl > 1 && (bundlepath || settings&F_FAST)) {
+    exprs_free();
+    die("%s: -%c can't be used with many PATTERNS",argv0,bundlepath ? 'c' : 'F');
+  }
+  if (bundlepath || settings&F_ORDER) {
+    if (bundlepath)
+      save_bundle(bundlepath);
+    if (settings&F_ORDER)
+      for (size_t i = 0; i < exprsl; i++)
+        reliq_print_order(&exprs[i],outfiles[i]);
+    exprs_free();
+    if (outfile != stdout)
+      fclose(outfile);
+    return 0;
+  }
   int g = optind;
   for (; g < argc; g++)
     file_handle(argv[g]);
   if (g-optind == 0)
     file_handle(NULL);
 
+  exprs_free();
   if (outfile != stdout)
     fclose(outfile);
-  reliq_efree(&exprs);
 
   return 0;
 }
@@ -32,6 +32,7 @@ typedef unsigned int uint;
 typedef unsigned long int ulong;
 
 #include "reliq.h"
+#include "hnode.h"
 #include "flexarr.h"
 #include "ctype.h"
 #include "edit.h"
@@ -44,7 +45,7 @@ typedef unsigned long int ulong;
 static void outfields_value_print(FILE *out, const reliq_output_field *field, const char *value, const size_t valuel);
 
 reliq_error *
-node_output(const reliq_hnode *hnode, const reliq_hnode *parent,
+node_output(const reliq_chnode *hnode, const reliq_chnode *parent,
         #ifdef RELIQ_EDITING
         const reliq_format_func *format
         #else
@@ -55,9 +56,9 @@ node_output(const reliq_hnode *hnode, const reliq_hnode *parent,
   return format_exec(NULL,0,output,hnode,parent,format,formatl,rq);
   #else
   if (format) {
-    reliq_printf(output,format,formatl,hnode,parent,rq);
+    hnode_printf(output,format,formatl,hnode,parent,rq);
   } else
-    reliq_print(output,hnode);
+    hnode_print(output,hnode,rq);
   return NULL;
   #endif
 }
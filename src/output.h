@@ -36,7 +36,7 @@ enum outfieldCode {
   ofBlockEnd
 };
 
-reliq_error *node_output(const reliq_hnode *hnode, const reliq_hnode *parent,
+reliq_error *node_output(const reliq_chnode *hnode, const reliq_chnode *parent,
         #ifdef RELIQ_EDITING
         const reliq_format_func *format
         #else
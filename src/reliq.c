@@ -26,6 +26,8 @@
 #include <string.h>
 #include <regex.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <pthread.h>
 
 typedef unsigned char uchar;
 typedef unsigned short ushort;
@@ -33,23 +35,35 @@ typedef unsigned int uint;
 typedef unsigned long int ulong;
 
 #include "reliq.h"
+#include "hnode.h"
 #include "flexarr.h"
 #include "ctype.h"
 #include "utils.h"
 #include "edit.h"
 #include "output.h"
 #include "html.h"
+#include "scan.h"
+#include "dfa.h"
 
 #define PASSED_INC (1<<14)
 #define PATTERN_SIZE_INC (1<<8)
 #define PATTRIB_INC 8
 #define HOOK_INC 8
 #define FORMAT_INC 8
+#define REGCACHE_INC 16
+#define LITERAL_MIN 2 //shorter literals are found as fast by matching
 #define NCOLLECTOR_INC (1<<8)
 #define FCOLLECTOR_INC (1<<5)
+#define FIRSTS_INC 16
+#define FIRSTS_TAGS 4096 //names of tags whose matching is remembered
 
 #define UINT_TO_STR_MAX 32
 
+#define INDEX_MAGIC "reliqidx"
+#define INDEX_VERSION 1
+
+#define BUNDLE_VERSION 2
+
 //reliq_pattrib flags
 #define A_INVERT 0x1
 #define A_VAL_MATTERS 0x2
@@ -72,6 +86,8 @@ typedef unsigned long int ulong;
 #define F_PATTERN 0x10
 #define F_EXPRS 0x20
 
+#define F_PATTERN_FLAGS "uWcas" //defaults of patterns of hooks
+
 //reliq_expr istable flags
 #define EXPR_TABLE 0x1
 #define EXPR_NEWBLOCK 0x2
@@ -80,6 +96,18 @@ typedef unsigned long int ulong;
 
 #define ATTRIB_INC (1<<3)
 #define RELIQ_NODES_INC (1<<13)
+#define RELIQ_ATTRIBS_INC (1<<13)
+#define ATTRIBS_CACHE_INC (1<<12)
+#define POSTINGS_INC (1<<10)
+#define POSTINGS_TAGS 256 //ids of known tags are lower
+#define POSTINGS_SUBTREE_MIN 64 //smaller subtrees are walked instead of searching in lists
+#define WORDS_INC (1<<16)
+#define WORD_SET_NONE 0xffff
+#define WORD_SET_SEEN 0xfffe
+#define PARALLEL_MIN_SIZE (1<<16) //smallest part of data given to a thread
+#define PARALLEL_CHUNK (1<<12) //nodes matched at once by a thread, few enough to stay in cache
+#define PARALLEL_MIN_NODES (1<<15) //fewer nodes are matched by a single thread
+#define PARALLEL_SOURCES_CHUNK 16 //sources whose subtrees are matched at once by a thread
 
 //reliq_pattern flags
 #define RELIQ_PATTERN_TRIM 0x1
@@ -119,12 +147,15 @@ typedef unsigned long int ulong;
 #define RELIQ_PATTERN_EMPTY 0x400
 #define RELIQ_PATTERN_ALL 0x800
 
+#define RELIQ_PATTERN_DEFAULT (RELIQ_PATTERN_TRIM|RELIQ_PATTERN_PASS_WHOLE|RELIQ_PATTERN_MATCH_FULL|RELIQ_PATTERN_TYPE_STR)
+
 static reliq_error *reliq_exec_pre(const reliq *rq, const reliq_expr *exprs, size_t exprsl, flexarr *source, flexarr *dest, flexarr **out, const ushort childfields, uchar isempty, uchar noncol, flexarr *ncollector
     #ifdef RELIQ_EDITING
     , flexarr *fcollector
     #endif
     );
 reliq_error *reliq_exec_r(reliq *rq, FILE *output, reliq_compressed **outnodes, size_t *outnodesl, const reliq_exprs *exprs);
+static reliq_error *exprs_comp(const char *src, size_t size, reliq_exprs *exprs, flexarr *regcache);
 
 struct reliq_match_hook {
   reliq_str8 name;
@@ -235,7 +266,7 @@ static void
 reliq_regcomp_get_flags(reliq_pattern *pattern, const char *src, size_t *pos, const size_t size, const char *flags)
 {
   size_t p = *pos;
-  pattern->flags = RELIQ_PATTERN_TRIM|RELIQ_PATTERN_PASS_WHOLE|RELIQ_PATTERN_MATCH_FULL|RELIQ_PATTERN_TYPE_STR;
+  pattern->flags = RELIQ_PATTERN_DEFAULT;
   pattern->range.s= 0;
 
   if (flags)
@@ -255,8 +286,71 @@ reliq_regcomp_get_flags(reliq_pattern *pattern, const char *src, size_t *pos, co
   return;
 }
 
+struct regex_cached {
+  char *src; //as given to regcomp()
+  int flags;
+  reliq_regex *reg;
+};
+
+static void
+regex_release(reliq_regex *reg)
+{
+  if (--reg->refs)
+    return;
+  regfree(&reg->reg);
+  dfa_free(reg->dfa);
+  if (reg->literal.b)
+    free(reg->literal.b);
+  free(reg);
+}
+
+static void
+regcache_free(flexarr *regcache)
+{
+  struct regex_cached *c = (struct regex_cached*)regcache->v;
+  for (size_t i = 0; i < regcache->size; i++) {
+    free(c[i].src);
+    regex_release(c[i].reg);
+  }
+  flexarr_free(regcache);
+}
+
+static reliq_regex *
+regex_get(flexarr *regcache, char *src, const int flags)
+{
+  //src is freed or taken by regcache
+  struct regex_cached *c = (struct regex_cached*)regcache->v;
+  for (size_t i = 0; i < regcache->size; i++) {
+    if (c[i].flags == flags && strcmp(c[i].src,src) == 0) {
+      free(src);
+      c[i].reg->refs++;
+      return c[i].reg;
+    }
+  }
+
+  reliq_regex *reg = malloc(sizeof(reliq_regex));
+  if (regcomp(&reg->reg,src,flags) != 0) {
+    free(reg);
+    free(src);
+    return NULL;
+  }
+  reg->dfa = dfa_comp(src,flags);
+  reg->literal.b = dfa_literal(src,flags,&reg->literal.s);
+  if (reg->literal.b && reg->literal.s < LITERAL_MIN) {
+    free(reg->literal.b);
+    reg->literal.b = NULL;
+    reg->literal.s = 0;
+  }
+  reg->refs = 2; //for pattern and regcache
+  c = (struct regex_cached*)flexarr_inc(regcache);
+  c->src = src;
+  c->flags = flags;
+  c->reg = reg;
+  return reg;
+}
+
 static reliq_error *
-reliq_regcomp_add_pattern(reliq_pattern *pattern, const char *src, const size_t size)
+reliq_regcomp_add_pattern(reliq_pattern *pattern, const char *src, const size_t size, flexarr *regcache)
 {
   ushort match = pattern->flags&RELIQ_PATTERN_MATCH,
     type = pattern->flags&RELIQ_PATTERN_TYPE;
@@ -266,10 +360,11 @@ reliq_regcomp_add_pattern(reliq_pattern *pattern, const char *src, const size_t
     return NULL;
   }
 
-  if (type == RELIQ_PATTERN_TYPE_STR) {
-    pattern->match.str.b = memdup(src,size);
-    pattern->match.str.s = size;
-  } else {
+  pattern->match.str.b = memdup(src,size);
+  pattern->match.str.s = size;
+  pattern->match.reg = NULL;
+
+  if (type != RELIQ_PATTERN_TYPE_STR) {
     int regexflags = REG_NOSUB;
     if (pattern->flags&RELIQ_PATTERN_CASE_INSENSITIVE)
       regexflags |= REG_ICASE;
@@ -297,9 +392,7 @@ reliq_regcomp_add_pattern(reliq_pattern *pattern, const char *src, const size_t
       tmp[p++] = '$';
     tmp[p] = 0;
 
-    int r = regcomp(&pattern->match.reg,tmp,regexflags);
-    free(tmp);
-    if (r != 0)
+    if (!(pattern->match.reg = regex_get(regcache,tmp,regexflags)))
       return reliq_set_error(1,"pattern: regcomp: could not compile pattern");
   }
   return NULL;
@@ -316,15 +409,18 @@ reliq_regfree(reliq_pattern *pattern)
   if (pattern->flags&RELIQ_PATTERN_EMPTY || pattern->flags&RELIQ_PATTERN_ALL)
     return;
 
-  if ((pattern->flags&RELIQ_PATTERN_TYPE) == RELIQ_PATTERN_TYPE_STR) {
-    if (pattern->match.str.b)
-      free(pattern->match.str.b);
-  } else
-    regfree(&pattern->match.reg);
+  //it can be freed again after failing at compilation
+  if (pattern->match.str.b) {
+    free(pattern->match.str.b);
+    pattern->match.str.b = NULL;
+  }
+  if (pattern->match.reg)
+    regex_release(pattern->match.reg);
+  pattern->match.reg = NULL;
 }
 
 static reliq_error *
-reliq_regcomp(reliq_pattern *pattern, char *src, size_t *pos, size_t *size, const char delim, const char *flags)
+reliq_regcomp(reliq_pattern *pattern, char *src, size_t *pos, size_t *size, const char delim, const char *flags, flexarr *regcache)
 {
   reliq_error *err;
 
@@ -351,7 +447,7 @@ reliq_regcomp(reliq_pattern *pattern, char *src, size_t *pos, size_t *size, cons
   if ((err = get_quoted(src,pos,size,delim,&start,&len)))
     goto ERR;
 
-  err = reliq_regcomp_add_pattern(pattern,src+start,len);
+  err = reliq_regcomp_add_pattern(pattern,src+start,len,regcache);
   if (err) {
     ERR: ;
     reliq_regfree(pattern);
@@ -422,11 +518,22 @@ reliq_regexec_match_pattern(const reliq_pattern *pattern, reliq_cstr *str)
     if (!str->s)
       return 0;
 
+    const reliq_regex *reg = pattern->match.reg;
+    if (reg->literal.b) {
+      if (pattern->flags&RELIQ_PATTERN_CASE_INSENSITIVE) {
+        if (!memcasemem(str->b,str->s,reg->literal.b,reg->literal.s))
+          return 0;
+      } else if (!memmem(str->b,str->s,reg->literal.b,reg->literal.s))
+        return 0;
+    }
+    if (reg->dfa)
+      return dfa_exec(reg->dfa,str->b,str->s);
+
     regmatch_t pmatch;
     pmatch.rm_so = 0;
     pmatch.rm_eo = (int)str->s;
 
-    if (regexec(&pattern->match.reg,str->b,1,&pmatch,REG_STARTEND) == 0)
+    if (regexec(&reg->reg,str->b,1,&pmatch,REG_STARTEND) == 0)
       return 1;
   }
   return 0;
@@ -546,32 +653,621 @@ reliq_nfree(reliq_node *node)
     goto REPEAT;
 }
 
+struct attribs_cache {
+  reliq_chnode const *nodes; //of reliq that it was made for, reliqs made from their parts use it too
+  size_t nodesl;
+  reliq_span_pair const **attribs; //of nodes at the same indexes, NULL if they weren't tokenized yet
+  ushort *attribsl;
+  flexarr *blocks; //reliq_span_pair*, tokenized attribs are never moved
+  reliq_span_pair *block;
+  size_t blockl; //free space left in block
+  flexarr *buffer;
+};
+
+static struct attribs_cache *
+attribs_cache_init(const reliq_chnode *nodes, const size_t nodesl)
+{
+  struct attribs_cache *c = calloc(1,sizeof(struct attribs_cache));
+  c->nodes = nodes;
+  c->nodesl = nodesl;
+  return c;
+}
+
+static void
+attribs_cache_free(struct attribs_cache *c)
+{
+  if (!c)
+    return;
+  if (c->attribs) {
+    free(c->attribs);
+    free(c->attribsl);
+    reliq_span_pair **blocks = (reliq_span_pair**)c->blocks->v;
+    for (size_t i = 0; i < c->blocks->size; i++)
+      free(blocks[i]);
+    flexarr_free(c->blocks);
+    flexarr_free(c->buffer);
+  }
+  free(c);
+}
+
+static const reliq_span_pair *
+attribs_get(const reliq *rq, const reliq_chnode *hnode, ushort *attribsl)
+{
+  if (!(rq->flags&RELIQ_ATTRIBS_LAZY)) {
+    *attribsl = hnode->attribsl;
+    return rq->attribs+hnode->attribs;
+  }
+
+  *attribsl = 0;
+  size_t start = hnode->tag.b+hnode->tag.s;
+  if (hnode->attribs <= start)
+    return NULL;
+
+  struct attribs_cache *c = (struct attribs_cache*)rq->attrib_buffer;
+  if (!c->attribs) {
+    c->attribs = calloc(c->nodesl,sizeof(reliq_span_pair*));
+    c->attribsl = malloc(c->nodesl*sizeof(ushort));
+    c->blocks = flexarr_init(sizeof(reliq_span_pair*),ATTRIB_INC);
+    c->buffer = flexarr_init(sizeof(reliq_span_pair),ATTRIB_INC);
+  }
+  size_t index = hnode-c->nodes;
+  if (c->attribs[index]) {
+    *attribsl = c->attribsl[index];
+    return c->attribs[index];
+  }
+
+  //it's tokenized the same way as at parsing, which ended at the end of start tag
+  c->buffer->size = 0;
+  html_attribs_handle(rq->data,&start,hnode->attribs,c->buffer);
+  size_t size = c->buffer->size;
+  if (size > c->blockl) {
+    c->blockl = (size > ATTRIBS_CACHE_INC) ? size : ATTRIBS_CACHE_INC;
+    c->block = malloc(c->blockl*sizeof(reliq_span_pair));
+    *(reliq_span_pair**)flexarr_inc(c->blocks) = c->block;
+  }
+  if (size)
+    memcpy(c->block,c->buffer->v,size*sizeof(reliq_span_pair));
+  c->attribs[index] = c->block;
+  c->attribsl[index] = size;
+  c->block += size;
+  c->blockl -= size;
+
+  *attribsl = size;
+  return c->attribs[index];
+}
+
+//attribs whose values are also indexed by their words
+static const char *postings_words[] = {"class","id","name"};
+
+struct posting {
+  uint64_t hash; //of key, colliding keys share the list which is still correct since nodes are matched anyway
+  uint count; //0 if slot is empty
+  uint start; //of list in lists
+  uint size; //nodes added to list
+  uint last; //index of last counted node plus 1
+};
+
+struct word {
+  uint32_t hash;
+  uint start; //offset in value of attrib
+};
+
+struct word_set {
+  uint start; //of its words in words
+  ushort size;
+  ushort attrib; //index of class attrib plus 1, 0 if node wasn't checked yet, or one of WORD_SET_*
+};
+
+struct postings {
+  reliq_chnode const *nodes; //of reliq that it was made for
+  size_t nodesl;
+  struct posting *table; //NULL until built
+  size_t tablel; //power of 2
+  uint *lists; //sorted indexes of nodes
+  uint lookups; //building pays off only if data is searched more than once
+  uint *tags; //sorted indexes of nodes grouped by their tag_id
+  uint tags_start[POSTINGS_TAGS+1]; //of lists in tags
+  struct word_set *word_sets; //of nodes at the same indexes, NULL until first needed
+  uchar shared; //nodes are matched by many threads so nothing can be built
+  flexarr *words; //struct word, words of class attribs
+};
+
+static void
+postings_tags(struct postings *p)
+{
+  //it's a single pass over nodes, cheap enough to be done always
+  uint *start = p->tags_start;
+  for (size_t i = 0; i < p->nodesl; i++) {
+    ushort id = p->nodes[i].tag_id;
+    start[(id < POSTINGS_TAGS) ? id+1 : 1]++;
+  }
+  for (uint i = 0; i < POSTINGS_TAGS; i++)
+    start[i+1] += start[i];
+
+  uint *pos = malloc(POSTINGS_TAGS*sizeof(uint));
+  memcpy(pos,start,POSTINGS_TAGS*sizeof(uint));
+  p->tags = malloc((p->nodesl ? p->nodesl : 1)*sizeof(uint));
+  for (size_t i = 0; i < p->nodesl; i++) {
+    ushort id = p->nodes[i].tag_id;
+    p->tags[pos[(id < POSTINGS_TAGS) ? id : 0]++] = i;
+  }
+  free(pos);
+}
+
+static struct postings *
+postings_init(const reliq_chnode *nodes, const size_t nodesl)
+{
+  struct postings *p = calloc(1,sizeof(struct postings));
+  p->nodes = nodes;
+  p->nodesl = nodesl;
+  postings_tags(p);
+  return p;
+}
+
+static void
+postings_free(struct postings *p)
+{
+  if (!p)
+    return;
+  if (p->table) {
+    free(p->table);
+    free(p->lists);
+  }
+  free(p->tags);
+  if (p->word_sets) {
+    free(p->word_sets);
+    flexarr_free(p->words);
+  }
+  free(p);
+}
+
+static uint64_t
+key_hash(uint64_t h, const char *ptr, const size_t size)
+{
+  for (size_t i = 0; i < size; i++) {
+    uchar c = ptr[i];
+    if (c >= 'A' && c <= 'Z')
+      c += 'a'-'A';
+    h = (h^c)*0x100000001b3;
+  }
+  return h;
+}
+
+#define KEY_HASH_INIT 0xcbf29ce484222325
+#define KEY_HASH_WORD(x) (((x)^0xff)*0x100000001b3) //separates name from word
+
+static uchar
+postings_indexes_words(const char *name, const size_t namel)
+{
+  for (size_t i = 0; i < LENGTH(postings_words); i++)
+    if (strlen(postings_words[i]) == namel && memcasecmp(postings_words[i],name,namel) == 0)
+      return 1;
+  return 0;
+}
+
+static void
+postings_keys(const reliq *rq, const reliq_chnode *hnode, flexarr *keys)
+{
+  ushort al;
+  const reliq_span_pair *a = attribs_get(rq,hnode,&al);
+  for (ushort i = 0; i < al; i++) {
+    const char *name = rq->data+a[i].f.b;
+    uint64_t h = key_hash(KEY_HASH_INIT,name,a[i].f.s);
+    *(uint64_t*)flexarr_inc(keys) = h;
+    if (!postings_indexes_words(name,a[i].f.s))
+      continue;
+
+    const char *ptr = rq->data+a[i].s.b;
+    size_t plen = a[i].s.s;
+    char const *saveptr,*word;
+    size_t saveptrlen,wordlen;
+    while (1) {
+      memwordtok_r(ptr,plen,(void const**)&saveptr,&saveptrlen,(void const**)&word,&wordlen);
+      if (!word)
+        break;
+      *(uint64_t*)flexarr_inc(keys) = key_hash(KEY_HASH_WORD(h),word,wordlen);
+      ptr = NULL;
+    }
+  }
+}
+
+static struct posting *
+postings_slot(const struct postings *p, const uint64_t hash)
+{
+  size_t mask = p->tablel-1;
+  size_t i = hash&mask;
+  while (p->table[i].count && p->table[i].hash != hash)
+    i = (i+1)&mask;
+  return &p->table[i];
+}
+
+static void
+postings_grow(struct postings *p)
+{
+  struct posting *prev = p->table;
+  size_t prevl = p->tablel;
+  p->tablel = prevl ? prevl*2 : POSTINGS_INC;
+  p->table = calloc(p->tablel,sizeof(struct posting));
+  for (size_t i = 0; i < prevl; i++)
+    if (prev[i].count)
+      *postings_slot(p,prev[i].hash) = prev[i];
+  free(prev);
+}
+
+static void
+postings_build(const reliq *rq, struct postings *p)
+{
+  //lists are counted first so that they can be stored in one array
+  flexarr *keys = flexarr_init(sizeof(uint64_t),POSTINGS_INC);
+  uint *ends = malloc((p->nodesl ? p->nodesl : 1)*sizeof(uint)); //of keys of nodes
+  size_t total = 0, used = 0;
+  postings_grow(p);
+  for (size_t i = 0; i < p->nodesl; i++) {
+    size_t j = keys->size;
+    postings_keys(rq,p->nodes+i,keys);
+    ends[i] = keys->size;
+    uint64_t *k = (uint64_t*)keys->v;
+    for (; j < keys->size; j++) {
+      if (used*2 >= p->tablel)
+        postings_grow(p);
+      struct posting *s = postings_slot(p,k[j]);
+      if (!s->count) {
+        s->hash = k[j];
+        used++;
+      } else if (s->last == i+1)
+        continue;
+      s->last = i+1;
+      s->count++;
+      total++;
+    }
+  }
+
+  size_t start = 0;
+  for (size_t i = 0; i < p->tablel; i++) {
+    p->table[i].start = start;
+    start += p->table[i].count;
+  }
+  p->lists = malloc((total ? total : 1)*sizeof(uint));
+
+  uint64_t *k = (uint64_t*)keys->v;
+  for (size_t i=0,j=0; i < p->nodesl; i++) {
+    for (; j < ends[i]; j++) {
+      struct posting *s = postings_slot(p,k[j]);
+      uint *list = p->lists+s->start;
+      if (s->size && list[s->size-1] == i)
+        continue;
+      list[s->size++] = i;
+    }
+  }
+  free(ends);
+  flexarr_free(keys);
+}
+
+static const uint *
+postings_get(const reliq *rq, const uint64_t hash, size_t *size)
+{
+  struct postings *p = (struct postings*)rq->postings;
+  if (!p->table)
+    postings_build(rq,p);
+  struct posting *s = postings_slot(p,hash);
+  *size = s->count;
+  return p->lists+s->start;
+}
+
+static uchar
+pattern_is_literal(const reliq_pattern *pattern)
+{
+  //matches only strings equal to its source
+  ushort flags = pattern->flags;
+  return (flags&RELIQ_PATTERN_TYPE) == RELIQ_PATTERN_TYPE_STR
+    && (flags&RELIQ_PATTERN_MATCH) == RELIQ_PATTERN_MATCH_FULL
+    && !(flags&(RELIQ_PATTERN_INVERT|RELIQ_PATTERN_EMPTY|RELIQ_PATTERN_ALL))
+    && !pattern->range.s;
+}
+
+static uchar
+pattrib_indexed(const struct reliq_pattrib *attrib)
+{
+  //attrib that has to be present and has literal name has its own posting list
+  return attrib->flags&A_INVERT && pattern_is_literal(&attrib->r[0]);
+}
+
+static const uint *
+node_tag_candidates(const reliq *rq, const reliq_node *node, size_t *candidatesl)
+{
+  //returns sorted indexes of nodes having the same known tag as node, or NULL if tag isn't literal
+  if (!rq->postings || node->flags&N_EMPTY || !node->tag_id
+    || node->tag_id >= POSTINGS_TAGS || node->tag.flags&RELIQ_PATTERN_INVERT)
+    return NULL;
+  struct postings *p = (struct postings*)rq->postings;
+  *candidatesl = p->tags_start[node->tag_id+1]-p->tags_start[node->tag_id];
+  return p->tags+p->tags_start[node->tag_id];
+}
+
+static const uint *
+node_candidates(const reliq *rq, const reliq_node *node, size_t *candidatesl)
+{
+  //returns sorted indexes of nodes that can only be matched by node, or NULL if it could be any of them
+  if (!rq->postings || node->flags&N_EMPTY)
+    return NULL;
+
+  struct postings *p = (struct postings*)rq->postings;
+  *candidatesl = 0;
+  const uint *ret = node_tag_candidates(rq,node,candidatesl);
+  for (size_t i = 0; i < node->attribsl; i++) {
+    const struct reliq_pattrib *a = &node->attribs[i];
+    if (!pattrib_indexed(a))
+      continue;
+
+    const reliq_str *name = &a->r[0].match.str;
+    uint64_t h = key_hash(KEY_HASH_INIT,name->b,name->s);
+    if (a->flags&A_VAL_MATTERS && pattern_is_literal(&a->r[1])
+      && postings_indexes_words(name->b,name->s)) {
+      //every word of value that is equal to pattern is also a word of pattern
+      char const *saveptr,*word;
+      size_t saveptrlen,wordlen;
+      memwordtok_r(a->r[1].match.str.b,a->r[1].match.str.s,(void const**)&saveptr,&saveptrlen,(void const**)&word,&wordlen);
+      if (word)
+        h = key_hash(KEY_HASH_WORD(h),word,wordlen);
+    }
+
+    //the first node that could use it is matched by scanning, building starts from the second one
+    if (!p->table && p->lookups++ == 0)
+      break;
+
+    size_t size;
+    const uint *list = postings_get(rq,h,&size);
+    if (!ret || size < *candidatesl) {
+      ret = list;
+      *candidatesl = size;
+    }
+  }
+  return ret;
+}
+
+static uint32_t
+word_hash(const char *ptr, const size_t size)
+{
+  //only length and bytes at both ends are hashed, letters are lowered by setting 0x20
+  //which only makes some other bytes collide, all of which is fine for rejecting words
+  uint64_t b=0,e=0;
+  if (size >= 8) {
+    memcpy(&b,ptr,8);
+    memcpy(&e,ptr+size-8,8);
+  } else
+    for (size_t i = 0; i < size; i++)
+      b |= (uint64_t)(uchar)ptr[i]<<(i*8);
+  b |= 0x2020202020202020;
+  e |= 0x2020202020202020;
+  return ((b*0x9e3779b97f4a7c15)^(e*0xc2b2ae3d27d4eb4f)^size)>>32;
+}
+
+static const struct word_set *
+word_set_get(const reliq *rq, const reliq_chnode *hnode, const reliq_span_pair *a, const ushort al)
+{
+  struct postings *p = (struct postings*)rq->postings;
+  if (!p->word_sets) {
+    p->word_sets = calloc(p->nodesl ? p->nodesl : 1,sizeof(struct word_set));
+    p->words = flexarr_init(sizeof(struct word),WORDS_INC);
+  }
+  struct word_set *set = &p->word_sets[hnode-p->nodes];
+  if (set->attrib && set->attrib != WORD_SET_SEEN)
+    return set;
+  if (!set->attrib) { //like postings, it's hashed only if node is checked more than once
+    set->attrib = WORD_SET_SEEN;
+    return set;
+  }
+
+  set->attrib = WORD_SET_NONE;
+  for (ushort i = 0; i < al && i+1 < WORD_SET_SEEN; i++) {
+    if (a[i].f.s != 5 || memcasecmp(rq->data+a[i].f.b,"class",5) != 0)
+      continue;
+    set->attrib = i+1;
+    set->start = p->words->size;
+    const char *ptr = rq->data+a[i].s.b;
+    size_t size = a[i].s.s;
+    if (p->words->asize-p->words->size <= size/2) //words are separated so there are at most that many
+      flexarr_alloc(p->words,size/2+WORDS_INC);
+    struct word *words = (struct word*)p->words->v+set->start;
+    for (size_t j = 0; j < size && set->size < WORD_SET_NONE;) {
+      //the same words as from memwordtok_r()
+      while_is(isspace,ptr,j,size);
+      if (j >= size)
+        break;
+      size_t start = j;
+      while (j < size && !isspace(ptr[j]))
+        j++;
+      words[set->size++] = (struct word){word_hash(ptr+start,j-start),start};
+    }
+    p->words->size += set->size;
+    break;
+  }
+  return set;
+}
+
+static int
+pattrib_words_match(const reliq *rq, const reliq_chnode *hnode, const reliq_span_pair *a, const ushort al, const ushort index, const reliq_pattern *pattern)
+{
+  //matches word pattern against hashed words of class attrib, returns -1 if it can't be done
+  struct postings *p = (struct postings*)rq->postings;
+  if (!p || hnode < p->nodes || hnode >= p->nodes+p->nodesl
+    || (pattern->flags&RELIQ_PATTERN_PASS) != RELIQ_PATTERN_PASS_WORD
+    || !pattern_is_literal(pattern) || !pattern->match.str.s)
+    return -1;
+
+  if (p->shared && (!p->word_sets || !p->word_sets[hnode-p->nodes].attrib
+    || p->word_sets[hnode-p->nodes].attrib == WORD_SET_SEEN))
+    return -1;
+  const struct word_set *set = word_set_get(rq,hnode,a,al);
+  if (set->attrib != index+1 || set->size == WORD_SET_NONE)
+    return -1;
+
+  const char *str = pattern->match.str.b;
+  const size_t strl = pattern->match.str.s;
+  const char *value = rq->data+a[index].s.b;
+  const size_t valuel = a[index].s.s;
+  const uint32_t hash = word_hash(str,strl);
+  const struct word *words = (struct word*)p->words->v+set->start;
+  for (ushort i = 0; i < set->size; i++) {
+    if (words[i].hash != hash)
+      continue;
+    size_t end = words[i].start+strl;
+    if (end > valuel || (end < valuel && !isspace(value[end])))
+      continue;
+    if (pattern->flags&RELIQ_PATTERN_CASE_INSENSITIVE) {
+      if (memcasecmp(value+words[i].start,str,strl) == 0)
+        return 1;
+    } else if (memcmp(value+words[i].start,str,strl) == 0)
+      return 1;
+  }
+  return 0;
+}
+
 void
 reliq_free(reliq *rq)
 {
     if (rq == NULL)
       return;
-    for (size_t i = 0; i < rq->nodesl; i++)
-      free(rq->nodes[i].attribs);
+    if (rq->flags&RELIQ_ATTRIBS_LAZY)
+      attribs_cache_free((struct attribs_cache*)rq->attrib_buffer);
+    postings_free((struct postings*)rq->postings);
+    if (rq->flags&RELIQ_INDEXED)
+      return;
+    if (rq->attribsl)
+      free(rq->attribs);
     if (rq->nodesl)
       free(rq->nodes);
 }
 
+typedef struct {
+  reliq_cstr all;
+  reliq_cstr tag;
+  reliq_cstr insides;
+  unsigned int child_count;
+  unsigned short lvl;
+} reliq_hnode; //fields of reliq_chnode used by hnode_printf()
+
+static void
+hnode_conv(const reliq *rq, const reliq_chnode *c, reliq_hnode *d)
+{
+  char const *data = rq->data;
+  d->all = (reliq_cstr){data+c->all.b,c->all.s};
+  d->tag = (reliq_cstr){data+c->tag.b,c->tag.s};
+  d->insides = (reliq_cstr){data+c->insides.b,c->insides.s};
+  d->child_count = c->child_count;
+  d->lvl = c->lvl;
+}
+
+static void
+cattrib_conv(const reliq *rq, const reliq_span_pair *c, reliq_cstr_pair *d)
+{
+  d->f = (reliq_cstr){rq->data+c->f.b,c->f.s};
+  d->s = (reliq_cstr){rq->data+c->s.b,c->s.s};
+}
+
+size_t
+reliq_node_count(const reliq *rq)
+{
+  return rq->nodesl;
+}
+
+size_t
+reliq_node_index(const reliq *rq, const reliq_chnode *hnode)
+{
+  //hnode has to be one of nodes of rq, e.g. from reliq_compressed
+  if (!hnode)
+    return RELIQ_NODE_NONE;
+  return hnode-rq->nodes;
+}
+
+reliq_cstr
+reliq_node_all(const reliq *rq, const size_t i)
+{
+  const reliq_chnode *hnode = rq->nodes+i;
+  return (reliq_cstr){rq->data+hnode->all.b,hnode->all.s};
+}
+
+reliq_cstr
+reliq_node_tag(const reliq *rq, const size_t i)
+{
+  const reliq_chnode *hnode = rq->nodes+i;
+  return (reliq_cstr){rq->data+hnode->tag.b,hnode->tag.s};
+}
+
+reliq_cstr
+reliq_node_insides(const reliq *rq, const size_t i)
+{
+  const reliq_chnode *hnode = rq->nodes+i;
+  return (reliq_cstr){rq->data+hnode->insides.b,hnode->insides.s};
+}
+
+size_t
+reliq_node_attribsl(const reliq *rq, const size_t i)
+{
+  ushort attribsl;
+  attribs_get(rq,rq->nodes+i,&attribsl);
+  return attribsl;
+}
+
+reliq_cstr_pair
+reliq_node_attrib(const reliq *rq, const size_t i, const size_t attrib)
+{
+  //attrib has to be lower than reliq_node_attribsl()
+  ushort attribsl;
+  reliq_cstr_pair ret;
+  cattrib_conv(rq,attribs_get(rq,rq->nodes+i,&attribsl)+attrib,&ret);
+  return ret;
+}
+
+size_t
+reliq_node_child_count(const reliq *rq, const size_t i)
+{
+  return rq->nodes[i].child_count;
+}
+
+size_t
+reliq_node_lvl(const reliq *rq, const size_t i)
+{
+  return rq->nodes[i].lvl;
+}
+
+size_t
+reliq_node_parent(const reliq *rq, const size_t i)
+{
+  const uint parent = rq->nodes[i].parent;
+  return parent ? i-parent : RELIQ_NODE_NONE;
+}
+
+uchar
+reliq_node_tag_flags(const reliq *rq, const size_t i)
+{
+  return rq->nodes[i].tag_flags;
+}
+
 static int
-pattrib_match(const reliq_hnode *hnode, const struct reliq_pattrib *attribs, size_t attribsl)
+pattrib_match(const reliq *rq, const reliq_chnode *hnode, const struct reliq_pattrib *attribs, size_t attribsl)
 {
-  const reliq_cstr_pair *a = hnode->attribs;
+  if (!attribsl)
+    return 1;
+  char const *data = rq->data;
+  ushort al;
+  const reliq_span_pair *a = attribs_get(rq,hnode,&al);
   for (size_t i = 0; i < attribsl; i++) {
     uchar found = 0;
-    for (ushort j = 0; j < hnode->attribsl; j++) {
-      if (!range_match(j,&attribs[i].position,hnode->attribsl-1))
+    for (ushort j = 0; j < al; j++) {
+      if (!range_match(j,&attribs[i].position,al-1))
         continue;
 
-      if (!reliq_regexec(&attribs[i].r[0],a[j].f.b,a[j].f.s))
+      if (!reliq_regexec(&attribs[i].r[0],data+a[j].f.b,a[j].f.s))
         continue;
 
-      if (attribs[i].flags&A_VAL_MATTERS && !reliq_regexec(&attribs[i].r[1],a[j].s.b,a[j].s.s))
-        continue;
+      if (attribs[i].flags&A_VAL_MATTERS) {
+        int r = pattrib_words_match(rq,hnode,a,al,j,&attribs[i].r[1]);
+        if (r == -1)
+          r = reliq_regexec(&attribs[i].r[1],data+a[j].s.b,a[j].s.s);
+        if (!r)
+          continue;
+      }
 
       found = 1;
       break;
@@ -583,7 +1279,7 @@ pattrib_match(const reliq_hnode *hnode, const struct reliq_pattrib *attribs, siz
 }
 
 static int
-reliq_match_hooks(const reliq_hnode *hnode, const reliq_hnode *parent, const reliq_hook *hooks, const size_t hooksl)
+reliq_match_hooks(const reliq *rq, const reliq_chnode *hnode, const reliq_chnode *parent, const reliq_hook *hooks, const size_t hooksl)
 {
   for (size_t i = 0; i < hooksl; i++) {
     char const *src = NULL;
@@ -591,8 +1287,11 @@ reliq_match_hooks(const reliq_hnode *hnode, const reliq_hnode *parent, const rel
     uchar flags = hooks[i].flags;
 
     switch (flags&F_KINDS) {
-      case F_ATTRIBUTES:
-        srcl = hnode->attribsl;
+      case F_ATTRIBUTES: {
+        ushort al;
+        attribs_get(rq,hnode,&al);
+        srcl = al;
+        }
         break;
       case F_LEVEL_RELATIVE:
         srcl = (parent) ? hnode->lvl-parent->lvl : hnode->lvl;
@@ -604,7 +1303,7 @@ reliq_match_hooks(const reliq_hnode *hnode, const reliq_hnode *parent, const rel
         srcl = hnode->child_count;
         break;
       case F_MATCH_INSIDES:
-        src = hnode->insides.b;
+        src = rq->data+hnode->insides.b;
         srcl = hnode->insides.s;
         break;
     }
@@ -618,8 +1317,13 @@ reliq_match_hooks(const reliq_hnode *hnode, const reliq_hnode *parent, const rel
     } else if ((flags&F_KINDS) == F_CHILD_MATCH && flags&F_EXPRS) {
       reliq r;
       memset(&r,0,sizeof(reliq));
-      r.nodes = (reliq_hnode*)hnode;
+      r.data = rq->data;
+      r.size = rq->size;
+      r.nodes = (reliq_chnode*)hnode;
       r.nodesl = hnode->child_count+1;
+      r.attribs = rq->attribs;
+      r.attrib_buffer = rq->attrib_buffer;
+      r.flags = rq->flags&RELIQ_ATTRIBS_LAZY;
 
       size_t compressedl = 0;
       reliq_error *err = reliq_exec_r(&r,NULL,NULL,&compressedl,&hooks[i].match.exprs);
@@ -633,27 +1337,48 @@ reliq_match_hooks(const reliq_hnode *hnode, const reliq_hnode *parent, const rel
 }
 
 int
-reliq_match(const reliq_hnode *hnode, const reliq_hnode *parent, const reliq_node *node)
+hnode_match_tag(const reliq *rq, const reliq_chnode *hnode, const reliq_node *node)
+{
+  if (node->flags&N_EMPTY)
+    return 1;
+  if (node->tag_id)
+    return (hnode->tag_id == node->tag_id) != ((node->tag.flags&RELIQ_PATTERN_INVERT) != 0);
+  return reliq_regexec(&node->tag,rq->data+hnode->tag.b,hnode->tag.s);
+}
+
+int
+hnode_match(const reliq *rq, const reliq_chnode *hnode, const reliq_chnode *parent, const reliq_node *node)
 {
   if (node->flags&N_EMPTY)
     return 1;
 
-  if (!reliq_regexec(&node->tag,hnode->tag.b,hnode->tag.s))
+  if (!hnode_match_tag(rq,hnode,node))
+    return 0;
+
+  if (!reliq_match_hooks(rq,hnode,parent,node->hooks,node->hooksl_cheap))
     return 0;
 
-  if (!pattrib_match(hnode,node->attribs,node->attribsl))
+  if (!pattrib_match(rq,hnode,node->attribs,node->attribsl))
     return 0;
 
-  if (!reliq_match_hooks(hnode,parent,node->hooks,node->hooksl))
+  if (!reliq_match_hooks(rq,hnode,parent,node->hooks+node->hooksl_cheap,node->hooksl-node->hooksl_cheap))
     return 0;
 
   return 1;
 }
 
+int
+reliq_match(const reliq *rq, const size_t i, const size_t parent, const reliq_node *node)
+{
+  return hnode_match(rq,rq->nodes+i,(parent == RELIQ_NODE_NONE) ? NULL : rq->nodes+parent,node);
+}
+
 static void
-reliq_match_siblings(const reliq_hnode *nodes, const size_t nodesl, reliq_hnode *hnode, reliq_hnode *parent, reliq_node const *node, flexarr *dest)
+reliq_match_siblings(const reliq *rq, reliq_chnode *hnode, reliq_chnode *parent, reliq_node const *node, flexarr *dest)
 {
-  int r = reliq_match(hnode,parent,node);
+  const reliq_chnode *nodes = rq->nodes;
+  const size_t nodesl = rq->nodesl;
+  int r = hnode_match(rq,hnode,parent,node);
   if (!r)
     return;
   if (!node->node) {
@@ -673,22 +1398,22 @@ reliq_match_siblings(const reliq_hnode *nodes, const size_t nodesl, reliq_hnode
   ushort lvl = hnode->lvl;
   uchar islast = !(node->node && node->node->node);
 
-  if (nodes != hnode && (passall || node->siblings_preceding.b)) {
-    for (size_t i=(hnode-nodes)-1,found=0; nodes[i].lvl >= lvl; i--) {
-      if (nodes[i].lvl == lvl && reliq_match(&nodes[i],parent,node->node)) {
+  if (nodes != hnode && hnode->prev && (passall || node->siblings_preceding.b)) {
+    for (size_t i=(hnode-nodes)-hnode->prev,found=0;; i -= nodes[i].prev) {
+      if (hnode_match(rq,&nodes[i],parent,node->node)) {
         if (passall || range_match(found,&node->siblings_preceding,-1)) {
           if (!islast) {
             node = node->node;
             goto REPEAT;
           }
           reliq_compressed *x = (reliq_compressed*)flexarr_inc(dest);
-          x->hnode = (reliq_hnode *const)nodes+i;
+          x->hnode = (reliq_chnode *const)nodes+i;
           x->parent = parent;
         }
         found++;
       }
 
-      if (!i)
+      if (!nodes[i].prev)
         break;
     }
   }
@@ -696,14 +1421,14 @@ reliq_match_siblings(const reliq_hnode *nodes, const size_t nodesl, reliq_hnode
   if (hnode+1 < nodes+nodesl && (passall || node->siblings_subsequent.b)) {
     size_t first = hnode-nodes;
     for (size_t i=first,found=0; i < nodesl && nodes[i].lvl == lvl; i++) {
-      if (i != first && reliq_match(&nodes[i],parent,node->node)) {
+      if (i != first && hnode_match(rq,&nodes[i],parent,node->node)) {
         if (passall || range_match(found,&node->siblings_subsequent,-1)) {
           if (!islast) {
             node = node->node;
             goto REPEAT;
           }
           reliq_compressed *x = (reliq_compressed*)flexarr_inc(dest);
-          x->hnode = (reliq_hnode *const)nodes+i;
+          x->hnode = (reliq_chnode *const)nodes+i;
           x->parent = parent;
         }
         found++;
@@ -726,14 +1451,17 @@ print_trimmed_if(const reliq_cstr *str, const uchar trim, FILE *outfile)
 }
 
 static void
-print_attribs(const reliq_hnode *hnode, const uchar trim, FILE *outfile)
+print_attribs(const reliq *rq, const reliq_chnode *hnode, const uchar trim, FILE *outfile)
 {
-  reliq_cstr_pair *a = hnode->attribs;
-  for (ushort j = 0; j < hnode->attribsl; j++) {
+  reliq_cstr_pair a;
+  ushort attribsl;
+  const reliq_span_pair *attribs = attribs_get(rq,hnode,&attribsl);
+  for (ushort j = 0; j < attribsl; j++) {
+    cattrib_conv(rq,&attribs[j],&a);
     fputc(' ',outfile);
-    fwrite(a[j].f.b,1,a[j].f.s,outfile);
+    fwrite(a.f.b,1,a.f.s,outfile);
     fputs("=\"",outfile);
-    print_trimmed_if(&a[j].s,trim,outfile);
+    print_trimmed_if(&a.s,trim,outfile);
     fputc('"',outfile);
   }
 }
@@ -749,36 +1477,44 @@ print_uint(unsigned long num, FILE *outfile)
 }
 
 static void
-print_attrib_value(const reliq_cstr_pair *attribs, const size_t attribsl, const char *text, const size_t textl, const int num, const uchar trim, FILE *outfile)
+print_attrib_value(const reliq *rq, const reliq_chnode *hnode, const char *text, const size_t textl, const int num, const uchar trim, FILE *outfile)
 {
+  reliq_cstr_pair a;
+  ushort attribsl;
+  const reliq_span_pair *attribs = attribs_get(rq,hnode,&attribsl);
   if (num != -1) {
-    if ((size_t)num < attribsl)
-      print_trimmed_if(&attribs[num].s,trim,outfile);
+    if ((size_t)num < attribsl) {
+      cattrib_conv(rq,&attribs[num],&a);
+      print_trimmed_if(&a.s,trim,outfile);
+    }
   } else if (textl != 0) {
-    for (size_t i = 0; i < attribsl; i++)
-      if (memcomp(attribs[i].f.b,text,textl,attribs[i].f.s))
-        print_trimmed_if(&attribs[i].s,trim,outfile);
+    for (size_t i = 0; i < attribsl; i++) {
+      cattrib_conv(rq,&attribs[i],&a);
+      if (memcomp(a.f.b,text,textl,a.f.s))
+        print_trimmed_if(&a.s,trim,outfile);
+    }
   } else for (size_t i = 0; i < attribsl; i++) {
-    print_trimmed_if(&attribs[i].s,trim,outfile);
+    cattrib_conv(rq,&attribs[i],&a);
+    print_trimmed_if(&a.s,trim,outfile);
     fputc('"',outfile);
   }
 }
 
 static void
-print_text(const reliq_hnode *nodes, const reliq_hnode *hnode, FILE *outfile, uchar recursive)
+print_text(const char *data, const reliq_chnode *hnode, FILE *outfile, uchar recursive)
 {
-  char const *start = hnode->insides.b;
+  size_t start = hnode->insides.b;
   size_t end;
 
   for (size_t i = 1; i <= hnode->child_count; i++) {
-    const reliq_hnode *n = hnode+i;
+    const reliq_chnode *n = hnode+i;
 
     end = n->all.b-start;
     if (end)
-      fwrite(start,1,end,outfile);
+      fwrite(data+start,1,end,outfile);
 
     if (recursive)
-      print_text(nodes,n,outfile,recursive);
+      print_text(data,n,outfile,recursive);
 
     i += n->child_count;
     start = n->all.b+n->all.s;
@@ -786,12 +1522,15 @@ print_text(const reliq_hnode *nodes, const reliq_hnode *hnode, FILE *outfile, uc
 
   end = hnode->insides.s-(start-hnode->insides.b);
   if (end)
-    fwrite(start,1,end,outfile);
+    fwrite(data+start,1,end,outfile);
 }
 
 void
-reliq_printf(FILE *outfile, const char *format, const size_t formatl, const reliq_hnode *hnode, const reliq_hnode *parent, const reliq *rq)
+hnode_printf(FILE *outfile, const char *format, const size_t formatl, const reliq_chnode *chnode, const reliq_chnode *parent, const reliq *rq)
 {
+  reliq_hnode node;
+  reliq_hnode *hnode = &node;
+  hnode_conv(rq,chnode,hnode);
   size_t i = 0;
   char const *text;
   size_t textl=0;
@@ -825,8 +1564,8 @@ reliq_printf(FILE *outfile, const char *format, const size_t formatl, const reli
         case 'i':
           trim = 1;
         case 'I': print_trimmed_if(&hnode->insides,trim,outfile); break;
-        case 't': print_text(rq->nodes,hnode,outfile,0); break;
-        case 'T': print_text(rq->nodes,hnode,outfile,1); break;
+        case 't': print_text(rq->data,chnode,outfile,0); break;
+        case 'T': print_text(rq->data,chnode,outfile,1); break;
         case 'l': {
           ushort lvl = hnode->lvl;
           if (parent)
@@ -837,16 +1576,16 @@ reliq_printf(FILE *outfile, const char *format, const size_t formatl, const reli
         case 'L': print_uint(hnode->lvl,outfile); break;
         case 'a':
           trim = 1;
-        case 'A': print_attribs(hnode,trim,outfile); break;
+        case 'A': print_attribs(rq,chnode,trim,outfile); break;
         case 'v':
           trim = 1;
         case 'V':
-          print_attrib_value(hnode->attribs,hnode->attribsl,text,textl,num,trim,outfile);
+          print_attrib_value(rq,chnode,text,textl,num,trim,outfile);
           break;
         case 's': print_uint(hnode->all.s,outfile); break;
         case 'c': print_uint(hnode->child_count,outfile); break;
         case 'C': fwrite(hnode->all.b,1,hnode->all.s,outfile); break;
-        case 'p': print_uint(hnode->all.b-rq->data,outfile); break;
+        case 'p': print_uint(chnode->all.b+((rq->flags&RELIQ_STREAM) ? ((reliq_stream*)rq)->offset : 0),outfile); break;
         case 'n': fwrite(hnode->tag.b,1,hnode->tag.s,outfile); break;
       }
       continue;
@@ -856,31 +1595,155 @@ reliq_printf(FILE *outfile, const char *format, const size_t formatl, const reli
 }
 
 void
-reliq_print(FILE *outfile, const reliq_hnode *hnode)
+hnode_print(FILE *outfile, const reliq_chnode *hnode, const reliq *rq)
 {
-  fwrite(hnode->all.b,1,hnode->all.s,outfile);
+  fwrite(rq->data+hnode->all.b,1,hnode->all.s,outfile);
   fputc('\n',outfile);
 }
 
-static reliq_error *
-format_comp(char *src, size_t *pos, size_t *size,
-#ifdef RELIQ_EDITING
-  reliq_format_func **format,
-#else
-  char **format,
-#endif
-  size_t *formatl)
+void
+reliq_printf(FILE *outfile, const char *format, const size_t formatl, const size_t i, const size_t parent, const reliq *rq)
 {
-  reliq_error *err;
-  if (*pos >= *size || !src)
-    return NULL;
-  #ifndef RELIQ_EDITING
-  while_is(isspace,src,*pos,*size);
+  hnode_printf(outfile,format,formatl,rq->nodes+i,(parent == RELIQ_NODE_NONE) ? NULL : rq->nodes+parent,rq);
+}
 
-  if (src[*pos] != '"' && src[*pos] != '\'')
-    return NULL;
+void
+reliq_print(FILE *outfile, const size_t i, const reliq *rq)
+{
+  hnode_print(outfile,rq->nodes+i,rq);
+}
 
-  size_t start,len;
+static uchar
+printf_needs(const char *format, const size_t formatl)
+{
+  //goes through format the same way as hnode_printf()
+  uchar needs = 0;
+  for (size_t i = 0; i < formatl; i++) {
+    if (format[i] == '\\') {
+      i++;
+      continue;
+    }
+    if (format[i] != '%')
+      continue;
+    if (++i >= formatl)
+      break;
+    if (isdigit(format[i])) {
+      number_handle(format,&i,formatl);
+    } else if (format[i] == '(') {
+      char *t = memchr(format+i,')',formatl-i);
+      if (!t)
+        break;
+      i = t-format+1;
+    }
+    if (i >= formatl)
+      break;
+
+    switch (format[i]) {
+      case 'a':
+      case 'A':
+      case 'v':
+      case 'V': needs |= RELIQ_NEEDS_ATTRIBS; break;
+      case 'i':
+      case 'I': needs |= RELIQ_NEEDS_INSIDES; break;
+      case 'c': needs |= RELIQ_NEEDS_CHILD_COUNT; break;
+      case 't':
+      case 'T': needs |= RELIQ_NEEDS_TEXT; break;
+    }
+  }
+  return needs;
+}
+
+static uchar
+format_needs(
+#ifdef RELIQ_EDITING
+  const reliq_format_func *format,
+#else
+  const char *format,
+#endif
+  const size_t formatl)
+{
+  //nodes without printf are printed whole
+  #ifdef RELIQ_EDITING
+  if (!formatl || format[0].flags&FORMAT_FUNC || !format[0].arg[0])
+    return 0;
+  reliq_cstr *f = (reliq_cstr*)format[0].arg[0];
+  return f->b ? printf_needs(f->b,f->s) : 0;
+  #else
+  return format ? printf_needs(format,formatl) : 0;
+  #endif
+}
+
+static uchar
+node_needs(reliq_node *node)
+{
+  //sets needs and lvl_max of node and nodes chained to it
+  uchar needs = 0;
+  if (node->node)
+    needs = node_needs(node->node)|RELIQ_NEEDS_SIBLINGS;
+  if (node->siblings_preceding.b || node->siblings_subsequent.b)
+    needs |= RELIQ_NEEDS_SIBLINGS;
+  if (node->attribsl)
+    needs |= RELIQ_NEEDS_ATTRIBS;
+
+  for (size_t i = 0; i < node->hooksl; i++) {
+    switch (node->hooks[i].flags&F_KINDS) {
+      case F_LEVEL:
+      case F_LEVEL_RELATIVE: {
+        uint max = range_max(&node->hooks[i].match.range);
+        if (max < node->lvl_max)
+          node->lvl_max = max;
+        }
+        break;
+      case F_ATTRIBUTES: needs |= RELIQ_NEEDS_ATTRIBS; break;
+      case F_MATCH_INSIDES: needs |= RELIQ_NEEDS_INSIDES; break;
+      case F_CHILD_COUNT: needs |= RELIQ_NEEDS_CHILD_COUNT; break;
+      case F_CHILD_MATCH:
+        needs |= RELIQ_NEEDS_CHILD_COUNT;
+        if (node->hooks[i].flags&F_EXPRS)
+          needs |= node->hooks[i].match.exprs.needs;
+        break;
+    }
+  }
+  node->needs = needs;
+  return needs;
+}
+
+static uchar
+exprs_needs(flexarr *exprs)
+{
+  //sets needs of expressions and returns all of them
+  uchar needs = 0;
+  reliq_expr *exprsv = (reliq_expr*)exprs->v;
+  for (size_t i = 0; i < exprs->size; i++) {
+    reliq_expr *expr = &exprsv[i];
+    expr->needs = 0;
+    if (expr->e)
+      expr->needs = (expr->flags&EXPR_TABLE) ? exprs_needs((flexarr*)expr->e) : ((reliq_node*)expr->e)->needs;
+    expr->needs |= format_needs(expr->nodef,expr->nodefl);
+    needs |= expr->needs;
+  }
+  return needs;
+}
+
+static reliq_error *
+format_comp(char *src, size_t *pos, size_t *size,
+#ifdef RELIQ_EDITING
+  reliq_format_func **format,
+#else
+  char **format,
+#endif
+  size_t *formatl)
+{
+  reliq_error *err;
+  if (*pos >= *size || !src)
+    return NULL;
+  #ifndef RELIQ_EDITING
+  while_is(isspace,src,*pos,*size);
+
+  if (src[*pos] != '"' && src[*pos] != '\'')
+    return NULL;
+
+  size_t start,len;
   if ((err = get_quoted(src,pos,size,' ',&start,&len)))
     return err;
 
@@ -919,7 +1782,7 @@ exprs_check_chain(const reliq_exprs *exprs)
 }
 
 static reliq_error *
-match_hook_handle(char *src, size_t *pos, size_t *size, flexarr *hooks)
+match_hook_handle(char *src, size_t *pos, size_t *size, flexarr *hooks, flexarr *regcache)
 {
   reliq_error *err;
   size_t p = *pos;
@@ -971,14 +1834,14 @@ match_hook_handle(char *src, size_t *pos, size_t *size, flexarr *hooks)
       size_t start,len;
       if ((err = get_quoted(src,pos,size,tf,&start,&len)))
         return err;
-      if ((err = reliq_ecomp(src+start,len,&hook.match.exprs)))
+      if ((err = exprs_comp(src+start,len,&hook.match.exprs,regcache)))
         return err;
       if ((err = exprs_check_chain(&hook.match.exprs))) {
         reliq_efree(&hook.match.exprs);
         return err;
       }
     } else {
-      if ((err = reliq_regcomp(&hook.match.pattern,src,pos,size,' ',"uWcas")))
+      if ((err = reliq_regcomp(&hook.match.pattern,src,pos,size,' ',F_PATTERN_FLAGS,regcache)))
         return err;
       if (!hook.match.pattern.range.s && hook.match.pattern.flags&RELIQ_PATTERN_ALL) { //ignore if it matches everything
         reliq_regfree(&hook.match.pattern);
@@ -992,7 +1855,7 @@ match_hook_handle(char *src, size_t *pos, size_t *size, flexarr *hooks)
 }
 
 static reliq_error *
-get_pattribs(char *src, size_t *pos, size_t *size, struct reliq_pattrib **attrib, size_t *attribl, reliq_hook **hooks, size_t *hooksl, reliq_range *position, reliq_range *sibling_preceding, reliq_range *sibling_subsequent, uchar *siblings)
+get_pattribs(char *src, size_t *pos, size_t *size, struct reliq_pattrib **attrib, size_t *attribl, reliq_hook **hooks, size_t *hooksl, reliq_range *position, reliq_range *sibling_preceding, reliq_range *sibling_subsequent, uchar *siblings, flexarr *regcache)
 {
   *siblings = 0;
   reliq_error *err = NULL;
@@ -1015,7 +1878,7 @@ get_pattribs(char *src, size_t *pos, size_t *size, struct reliq_pattrib **attrib
 
     if (isalpha(src[i])) {
       size_t prev = i;
-      if ((err = match_hook_handle(src,&i,size,phooks)))
+      if ((err = match_hook_handle(src,&i,size,phooks,regcache)))
         break;
       if (i != prev) {
         tofree = 0;
@@ -1098,14 +1961,14 @@ get_pattribs(char *src, size_t *pos, size_t *size, struct reliq_pattrib **attrib
     if (shortcut == '.' || shortcut == '#') {
       char *t_name = (shortcut == '.') ? "class" : "id";
       size_t t_pos=0,t_size=(shortcut == '.' ? 5 : 2);
-      if ((err = reliq_regcomp(&pa.r[0],t_name,&t_pos,&t_size,' ',"uWsfi")))
+      if ((err = reliq_regcomp(&pa.r[0],t_name,&t_pos,&t_size,' ',"uWsfi",regcache)))
         break;
 
-      if ((err = reliq_regcomp(&pa.r[1],src,&i,size,' ',"uwsf")))
+      if ((err = reliq_regcomp(&pa.r[1],src,&i,size,' ',"uwsf",regcache)))
         break;
       pa.flags |= A_VAL_MATTERS;
     } else {
-      if ((err = reliq_regcomp(&pa.r[0],src,&i,size,'=',NULL))) //!
+      if ((err = reliq_regcomp(&pa.r[0],src,&i,size,'=',NULL,regcache))) //!
         break;
 
       while_is(isspace,src,i,*size);
@@ -1117,7 +1980,7 @@ get_pattribs(char *src, size_t *pos, size_t *size, struct reliq_pattrib **attrib
         if (i >= *size)
           break;
 
-        if ((err = reliq_regcomp(&pa.r[1],src,&i,size,' ',NULL)))
+        if ((err = reliq_regcomp(&pa.r[1],src,&i,size,' ',NULL,regcache)))
           break;
         pa.flags |= A_VAL_MATTERS;
       } else {
@@ -1142,8 +2005,111 @@ get_pattribs(char *src, size_t *pos, size_t *size, struct reliq_pattrib **attrib
   return err;
 }
 
-reliq_error *
-reliq_ncomp(const char *script, size_t size, reliq_node *node)
+static ushort
+pattern_tag_id(const reliq_pattern *pattern)
+{
+  if ((pattern->flags&(RELIQ_PATTERN_TYPE|RELIQ_PATTERN_MATCH|RELIQ_PATTERN_PASS|RELIQ_PATTERN_CASE_INSENSITIVE|RELIQ_PATTERN_EMPTY|RELIQ_PATTERN_ALL))
+    != (RELIQ_PATTERN_TYPE_STR|RELIQ_PATTERN_MATCH_FULL|RELIQ_PATTERN_PASS_WHOLE))
+    return 0;
+  if (pattern->range.s)
+    return 0;
+  return html_tag_id(pattern->match.str.b,pattern->match.str.s);
+}
+
+#define COST_ATTRIBS 2 //attribs of node have to be found first
+
+static uchar
+pattern_cost(const reliq_pattern *pattern)
+{
+  if (pattern->flags&(RELIQ_PATTERN_ALL|RELIQ_PATTERN_EMPTY))
+    return 0;
+  uchar cost = ((pattern->flags&RELIQ_PATTERN_TYPE) == RELIQ_PATTERN_TYPE_STR) ? 1 : 4;
+  if ((pattern->flags&RELIQ_PATTERN_PASS) == RELIQ_PATTERN_PASS_WORD)
+    cost++;
+  return cost;
+}
+
+static uchar
+hook_cost(const reliq_hook *hook)
+{
+  switch (hook->flags&F_KINDS) {
+    case F_LEVEL:
+    case F_LEVEL_RELATIVE:
+    case F_CHILD_COUNT:
+      return 1;
+    case F_ATTRIBUTES:
+      return COST_ATTRIBS;
+    case F_MATCH_INSIDES: {
+      //insides are usually much longer than attribs
+      uchar cost = pattern_cost(&hook->match.pattern);
+      return cost ? 16+cost : 1;
+      }
+  }
+  return -1;
+}
+
+static uchar
+pattrib_cost(const struct reliq_pattrib *attrib)
+{
+  uchar cost = COST_ATTRIBS+pattern_cost(&attrib->r[0]);
+  if (attrib->flags&A_VAL_MATTERS)
+    cost += pattern_cost(&attrib->r[1]);
+  return cost;
+}
+
+static void
+sort_by_cost(void *arr, const size_t nmemb, const size_t size, uchar *costs)
+{
+  //stable insertion sort, nodes have only few conditions
+  union {
+    reliq_hook hook;
+    struct reliq_pattrib attrib;
+  } t;
+  char *a = (char*)arr;
+  for (size_t i = 1; i < nmemb; i++) {
+    uchar cost = costs[i];
+    size_t j = i;
+    if (costs[j-1] <= cost)
+      continue;
+    memcpy(&t,a+i*size,size);
+    for (; j > 0 && costs[j-1] > cost; j--) {
+      memcpy(a+j*size,a+(j-1)*size,size);
+      costs[j] = costs[j-1];
+    }
+    memcpy(a+j*size,&t,size);
+    costs[j] = cost;
+  }
+}
+
+static void
+node_order(reliq_node *node)
+{
+  //conditions are independent of each other so they are checked from the cheapest
+  for (; node; node = node->node) {
+    if (node->flags&N_EMPTY)
+      break;
+    size_t max = (node->hooksl > node->attribsl) ? node->hooksl : node->attribsl;
+    if (!max)
+      continue;
+    uchar *costs = malloc(max);
+
+    for (size_t i = 0; i < node->attribsl; i++)
+      costs[i] = pattrib_cost(&node->attribs[i]);
+    sort_by_cost(node->attribs,node->attribsl,sizeof(struct reliq_pattrib),costs);
+
+    for (size_t i = 0; i < node->hooksl; i++)
+      costs[i] = hook_cost(&node->hooks[i]);
+    sort_by_cost(node->hooks,node->hooksl,sizeof(reliq_hook),costs);
+    node->hooksl_cheap = 0;
+    while (node->hooksl_cheap < node->hooksl && costs[node->hooksl_cheap] <= COST_ATTRIBS)
+      node->hooksl_cheap++;
+
+    free(costs);
+  }
+}
+
+static reliq_error *
+node_comp(const char *script, size_t size, reliq_node *node, flexarr *regcache)
 {
   if (!node)
     return NULL;
@@ -1157,6 +2123,7 @@ reliq_ncomp(const char *script, size_t size, reliq_node *node)
   REPEAT: ;
 
   memset(node,0,sizeof(reliq_node));
+  node->lvl_max = -1;
   if (pos >= size) {
     node->flags |= N_EMPTY;
     if (pos)
@@ -1180,11 +2147,12 @@ reliq_ncomp(const char *script, size_t size, reliq_node *node)
     }
   }
 
-  if ((err = reliq_regcomp(&node->tag,nscript,&pos,&size,' ',NULL)))
+  if ((err = reliq_regcomp(&node->tag,nscript,&pos,&size,' ',NULL,regcache)))
     goto END;
+  node->tag_id = pattern_tag_id(&node->tag);
 
   uchar siblings;
-  err = get_pattribs(nscript,&pos,&size,&node->attribs,&node->attribsl,&node->hooks,&node->hooksl,&node->position,&node->siblings_preceding,&node->siblings_subsequent,&siblings);
+  err = get_pattribs(nscript,&pos,&size,&node->attribs,&node->attribsl,&node->hooks,&node->hooksl,&node->position,&node->siblings_preceding,&node->siblings_subsequent,&siblings,regcache);
 
   if (!err && pos < size && siblings) {
     node = node->node = malloc(sizeof(reliq_node));
@@ -1195,12 +2163,24 @@ reliq_ncomp(const char *script, size_t size, reliq_node *node)
   if (err) {
     END_FREE:;
     reliq_nfree(parentnode);
+  } else {
+    node_needs(parentnode);
+    node_order(parentnode);
   }
 
   free(nscript);
   return err;
 }
 
+reliq_error *
+reliq_ncomp(const char *script, size_t size, reliq_node *node)
+{
+  flexarr *regcache = flexarr_init(sizeof(struct regex_cached),REGCACHE_INC);
+  reliq_error *err = node_comp(script,size,node,regcache);
+  regcache_free(regcache);
+  return err;
+}
+
 /*void //just for debugging
 reliq_expr_print(flexarr *exprs, size_t tab)
 {
@@ -1269,6 +2249,13 @@ reliq_efree(reliq_exprs *exprs)
     if (exprs->b[i].flags&EXPR_TABLE) {
       if (exprs->b[i].outfield.name.b)
         free(exprs->b[i].outfield.name.b);
+      #ifdef RELIQ_EDITING
+      format_free(exprs->b[i].nodef,exprs->b[i].nodefl);
+      format_free(exprs->b[i].exprf,exprs->b[i].exprfl);
+      #else
+      if (exprs->b[i].nodef)
+        free(exprs->b[i].nodef);
+      #endif
       reliq_exprs_free_pre((flexarr*)exprs->b[i].e);
     } else
       reliq_expr_free(&exprs->b[i]);
@@ -1383,7 +2370,7 @@ reliq_output_field_get(const char *src, size_t *pos, const size_t s, reliq_outpu
 }
 
 static flexarr *
-reliq_ecomp_pre(const char *csrc, size_t *pos, size_t s, ushort *childfields, reliq_error **err)
+reliq_ecomp_pre(const char *csrc, size_t *pos, size_t s, ushort *childfields, flexarr *regcache, reliq_error **err)
 {
   if (s == 0)
     return NULL;
@@ -1602,12 +2589,12 @@ reliq_ecomp_pre(const char *csrc, size_t *pos, size_t s, ushort *childfields, re
         }
 
         if (expr.e) { //!
-          *err = reliq_ncomp(src+j,exprl,(reliq_node*)expr.e);
+          *err = node_comp(src+j,exprl,(reliq_node*)expr.e,regcache);
           if (*err)
             goto EXIT;
         }
       } else if (expr.e)
-        ((reliq_node*)expr.e)->flags |= N_EMPTY;
+        node_comp(NULL,0,(reliq_node*)expr.e,regcache); //makes it empty
 
       NODE_COMP_END:
       new = (reliq_expr*)flexarr_inc(acurrent->e);
@@ -1626,7 +2613,7 @@ reliq_ecomp_pre(const char *csrc, size_t *pos, size_t s, ushort *childfields, re
       new->flags |= EXPR_TABLE|EXPR_NEWBLOCK;
       next = typePassed;
       *pos = i;
-      new->e = reliq_ecomp_pre(src,pos,s,&new->childfields,err);
+      new->e = reliq_ecomp_pre(src,pos,s,&new->childfields,regcache,err);
       if (*err)
         goto EXIT;
       if (childfields)
@@ -1678,152 +2665,908 @@ reliq_ecomp_pre(const char *csrc, size_t *pos, size_t s, ushort *childfields, re
   return ret;
 }
 
-reliq_error *
-reliq_ecomp(const char *src, size_t size, reliq_exprs *exprs)
+static reliq_error *
+exprs_comp(const char *src, size_t size, reliq_exprs *exprs, flexarr *regcache)
 {
   reliq_error *err = NULL;
-  flexarr *ret = reliq_ecomp_pre(src,NULL,size,NULL,&err);
+  flexarr *ret = reliq_ecomp_pre(src,NULL,size,NULL,regcache,&err);
+  exprs->needs = 0;
   if (ret) {
     //reliq_expr_print(ret,0);
+    exprs->needs = exprs_needs(ret);
     flexarr_conv(ret,(void**)&exprs->b,&exprs->s);
   } else
     exprs->s = 0;
   return err;
 }
 
-static void
-dest_match_position(const reliq_range *range, flexarr *dest, size_t start, size_t end) {
-  reliq_compressed *x = (reliq_compressed*)dest->v;
-
-  while (start < end && (void*)x[start].hnode < (void*)10)
-    start++;
-  while (end != start && (void*)x[end-1].hnode < (void*)10)
-    end--;
+reliq_error *
+reliq_ecomp(const char *src, size_t size, reliq_exprs *exprs)
+{
+  flexarr *regcache = flexarr_init(sizeof(struct regex_cached),REGCACHE_INC);
+  reliq_error *err = exprs_comp(src,size,exprs,regcache);
+  regcache_free(regcache);
+  return err;
+}
 
-  size_t found = start;
-  for (size_t i = start; i < end; i++) {
-    if (!range_match(i-start,range,end-start-1))
-      continue;
-    if (found != i)
-      x[found] = x[i];
-    found++;
+static void
+pattern_print(const reliq_pattern *pattern, const char *defaults, FILE *output)
+{
+  //pattern is printed the way it's written, with flags that differ from defaults of its place
+  ushort d = RELIQ_PATTERN_DEFAULT;
+  if (defaults)
+    reliq_regcomp_set_flags(&d,defaults,strlen(defaults));
+  const ushort f = pattern->flags;
+  char flags[6];
+  size_t flagsl = 0;
+  if ((f^d)&RELIQ_PATTERN_TRIM)
+    flags[flagsl++] = (f&RELIQ_PATTERN_TRIM) ? 't' : 'u';
+  if ((f^d)&RELIQ_PATTERN_CASE_INSENSITIVE)
+    flags[flagsl++] = (f&RELIQ_PATTERN_CASE_INSENSITIVE) ? 'i' : 'c';
+  if ((f^d)&RELIQ_PATTERN_INVERT)
+    flags[flagsl++] = (f&RELIQ_PATTERN_INVERT) ? 'v' : 'n';
+  ushort match = f&RELIQ_PATTERN_MATCH;
+  if (match != (d&RELIQ_PATTERN_MATCH))
+    flags[flagsl++] = (match == RELIQ_PATTERN_MATCH_ALL) ? 'a' : (match == RELIQ_PATTERN_MATCH_BEGINNING) ? 'b'
+      : (match == RELIQ_PATTERN_MATCH_ENDING) ? 'e' : 'f';
+  if ((f&RELIQ_PATTERN_PASS) != (d&RELIQ_PATTERN_PASS))
+    flags[flagsl++] = ((f&RELIQ_PATTERN_PASS) == RELIQ_PATTERN_PASS_WORD) ? 'w' : 'W';
+  ushort type = f&RELIQ_PATTERN_TYPE;
+  if (type != (d&RELIQ_PATTERN_TYPE))
+    flags[flagsl++] = (type == RELIQ_PATTERN_TYPE_ERE) ? 'E' : (type == RELIQ_PATTERN_TYPE_BRE) ? 'B' : 's';
+
+  if (flagsl || pattern->range.s) {
+    fwrite(flags,1,flagsl,output);
+    fputc('>',output);
+    if (pattern->range.s)
+      range_print(&pattern->range,output);
   }
-  dest->size = found;
+  if (pattern->flags&RELIQ_PATTERN_ALL) {
+    if (!pattern->range.s)
+      fputc('*',output);
+    return;
+  }
+  fputc('"',output);
+  if (!(pattern->flags&RELIQ_PATTERN_EMPTY))
+    fwrite(pattern->match.str.b,1,pattern->match.str.s,output);
+  fputc('"',output);
 }
 
 static void
-node_exec_first(const reliq *rq, reliq_node *node, flexarr *dest)
+hook_print(const reliq_hook *hook, FILE *output)
 {
-  size_t nodesl = rq->nodesl;
-  for (size_t i = 0; i < nodesl; i++)
-    reliq_match_siblings(rq->nodes,rq->nodesl,rq->nodes+i,NULL,node,dest);
-
-  if (node->position.s)
-    dest_match_position(&node->position,dest,0,dest->size);
+  for (size_t i = 0; i < LENGTH(match_hooks); i++) {
+    if (match_hooks[i].flags == hook->flags && match_hooks[i].name.s > 1) {
+      fwrite(match_hooks[i].name.b,1,match_hooks[i].name.s,output);
+      break;
+    }
+  }
+  fputc('@',output);
+  if (hook->flags&F_PATTERN) {
+    pattern_print(&hook->match.pattern,F_PATTERN_FLAGS,output);
+  } else if (hook->flags&F_RANGE)
+    range_print(&hook->match.range,output);
 }
 
+static void exprs_print_order(const reliq_expr *exprs, const size_t exprsl, const size_t lvl, FILE *output);
+
 static void
-node_exec(const reliq *rq, reliq_node *node, flexarr *source, flexarr *dest)
+node_print_order(const reliq_node *node, const size_t lvl, FILE *output)
 {
-  if (source->size == 0) {
-    node_exec_first(rq,node,dest);
-    return;
-  }
+  for (; node; node = node->node) {
+    for (size_t i = 0; i < lvl; i++)
+      fputs("  ",output);
+    if (node->flags&N_EMPTY) {
+      fputs("empty\n",output);
+      return;
+    }
 
-  reliq_hnode *current;
-  for (size_t i = 0; i < source->size; i++) {
-    current = ((reliq_compressed*)source->v)[i].hnode;
-    if ((void*)current < (void*)10)
-      continue;
-    size_t prevdestsize = dest->size;
-    for (size_t j = 0; j <= current->child_count; j++)
-      reliq_match_siblings(rq->nodes,rq->nodesl,current+j,current,node,dest);
+    fputs("tag ",output);
+    pattern_print(&node->tag,NULL,output);
+    for (size_t i = 0; i < node->hooksl_cheap; i++) {
+      fputs(", ",output);
+      hook_print(&node->hooks[i],output);
+    }
+    for (size_t i = 0; i < node->attribsl; i++) {
+      struct reliq_pattrib *a = &node->attribs[i];
+      fputs(", attrib ",output);
+      if (!(a->flags&A_INVERT))
+        fputc('-',output);
+      pattern_print(&a->r[0],NULL,output);
+      if (a->flags&A_VAL_MATTERS) {
+        fputc('=',output);
+        pattern_print(&a->r[1],NULL,output);
+      }
+    }
+    for (size_t i = node->hooksl_cheap; i < node->hooksl; i++) {
+      fputs(", ",output);
+      hook_print(&node->hooks[i],output);
+    }
+    fputc('\n',output);
 
-    if (!(node->flags&N_POSITION_ABSOLUTE) && node->position.s)
-      dest_match_position(&node->position,dest,prevdestsize,dest->size);
+    for (size_t i = node->hooksl_cheap; i < node->hooksl; i++)
+      if (node->hooks[i].flags&F_EXPRS)
+        exprs_print_order(node->hooks[i].match.exprs.b,node->hooks[i].match.exprs.s,lvl+1,output);
   }
-  if (node->flags&N_POSITION_ABSOLUTE && node->position.s)
-    dest_match_position(&node->position,dest,0,dest->size);
 }
 
-/*static reliq_error *
-ncollector_check(flexarr *ncollector, size_t correctsize)
+static void
+exprs_print_order(const reliq_expr *exprs, const size_t exprsl, const size_t lvl, FILE *output)
 {
-  size_t ncollector_sum = 0;
-  reliq_cstr *pcol = (reliq_cstr*)ncollector->v;
-  for (size_t j = 0; j < ncollector->size; j++)
-    ncollector_sum += pcol[j].s;
-  if (ncollector_sum != correctsize)
-    return reliq_set_error(1,"ncollector does not match count of found tags, %lu != %lu",ncollector_sum,correctsize);
-  return NULL;
-}*/
+  for (size_t i = 0; i < exprsl; i++) {
+    if (exprs[i].flags&EXPR_TABLE) {
+      flexarr *e = (flexarr*)exprs[i].e;
+      exprs_print_order((reliq_expr*)e->v,e->size,lvl,output);
+    } else if (exprs[i].e)
+      node_print_order((reliq_node*)exprs[i].e,lvl,output);
+  }
+}
+
+void
+reliq_print_order(const reliq_exprs *exprs, FILE *output)
+{
+  //prints conditions of every node in order in which they are checked
+  exprs_print_order(exprs->b,exprs->s,0,output);
+}
+
+struct bundle_header {
+  char magic[8]; //RELIQ_BUNDLE_MAGIC
+  uint32_t version; //has to be changed with any flag used by expressions
+  uint16_t rangesize;
+  uint16_t editing; //format functions are saved instead of printf
+}; //followed by expressions
+
+static void node_save(const reliq_node *node, FILE *output);
+static int node_load(reliq_node *node, const char *ptr, const size_t size, size_t *pos, flexarr *regcache);
+static void exprs_save(const reliq_exprs *exprs, FILE *output);
+static int exprs_load(reliq_exprs *exprs, const char *ptr, const size_t size, size_t *pos, flexarr *regcache);
+static void expr_list_save(const reliq_expr *exprs, const size_t exprsl, FILE *output);
 
 static void
-ncollector_add(flexarr *ncollector, flexarr *dest, flexarr *source, size_t startn, size_t lastn, const reliq_expr *lastnode, uchar istable, uchar useformat, uchar isempty, uchar non)
+pattern_save(const reliq_pattern *pattern, FILE *output)
 {
-  if (!source->size && !isempty)
-    return;
-  size_t prevsize = dest->size;
-  flexarr_add(dest,source);
-  if (non || (useformat && !lastnode))
-    goto END;
-  if (istable&EXPR_TABLE && !isempty) {
-    if (startn != lastn) { //truncate previously added, now useless ncollector
-      for (size_t i = lastn; i < ncollector->size; i++)
-        ((reliq_cstr*)ncollector->v)[startn+i] = ((reliq_cstr*)ncollector->v)[i];
-      ncollector->size -= lastn-startn;
-    }
-  } else {
-    ncollector->size = startn;
-    *(reliq_cstr*)flexarr_inc(ncollector) = (reliq_cstr){(char const*)lastnode,dest->size-prevsize};
+  fwrite(&pattern->flags,sizeof(pattern->flags),1,output);
+  range_save(&pattern->range,output);
+  if (!(pattern->flags&(RELIQ_PATTERN_EMPTY|RELIQ_PATTERN_ALL)))
+    save_str(pattern->match.str.b,pattern->match.str.s,output);
+}
+
+static int
+pattern_load(reliq_pattern *pattern, const char *ptr, const size_t size, size_t *pos, flexarr *regcache)
+{
+  //regexes can't be saved so they are compiled again
+  if (load_bytes(&pattern->flags,sizeof(pattern->flags),ptr,size,pos)
+    || range_load(&pattern->range,ptr,size,pos))
+    return -1;
+  if (pattern->flags&(RELIQ_PATTERN_EMPTY|RELIQ_PATTERN_ALL))
+    return 0;
+
+  reliq_str src;
+  if (load_str(&src,ptr,size,pos))
+    return -1;
+  reliq_error *err = reliq_regcomp_add_pattern(pattern,src.b,src.s,regcache);
+  free(src.b);
+  if (err) {
+    free(err);
+    return -1;
   }
-  END: ;
-  source->size = 0;
+  return 0;
 }
 
-#ifdef RELIQ_EDITING
 static void
-fcollector_add(const size_t lastn, const uchar isnodef, const reliq_expr *expr, flexarr *ncollector, flexarr *fcollector)
+hook_save(const reliq_hook *hook, FILE *output)
 {
-  struct fcollector_expr *fcols = (struct fcollector_expr*)fcollector->v;
-  for (size_t i = fcollector->size; i > 0; i--) {
-    if (fcols[i-1].start < lastn)
-      break;
-    fcols[i-1].lvl++;
+  fwrite(&hook->flags,1,1,output);
+  if (hook->flags&F_RANGE) {
+    range_save(&hook->match.range,output);
+  } else if (hook->flags&F_EXPRS) {
+    exprs_save(&hook->match.exprs,output);
+  } else if (hook->flags&F_PATTERN)
+    pattern_save(&hook->match.pattern,output);
+}
+
+static int
+hook_load(reliq_hook *hook, const char *ptr, const size_t size, size_t *pos, flexarr *regcache)
+{
+  if (load_bytes(&hook->flags,1,ptr,size,pos))
+    return -1;
+  size_t i = 0; //only kinds with payloads that hooks are compiled to are valid
+  for (; i < LENGTH(match_hooks) && match_hooks[i].flags != hook->flags; i++);
+  if (i == LENGTH(match_hooks)) {
+    hook->flags = 0;
+    return -1;
   }
-  *(struct fcollector_expr*)flexarr_inc(fcollector) = (struct fcollector_expr){expr,lastn,ncollector->size-1,0,isnodef};
+  if (hook->flags&F_RANGE)
+    return range_load(&hook->match.range,ptr,size,pos);
+  if (hook->flags&F_EXPRS)
+    return exprs_load(&hook->match.exprs,ptr,size,pos,regcache);
+  if (hook->flags&F_PATTERN)
+    return pattern_load(&hook->match.pattern,ptr,size,pos,regcache);
+  return 0;
 }
-#endif
 
 static void
-add_compressed_blank(flexarr *dest, const enum outfieldCode val1, const void *val2)
+node_save(const reliq_node *node, FILE *output)
 {
-  reliq_compressed *x = flexarr_inc(dest);
-  x->hnode = (reliq_hnode *const)val1;
-  x->parent = (void *const)val2;
+  for (; node; node = node->node) {
+    uint32_t lvl_max = node->lvl_max;
+    fwrite(&node->flags,1,1,output);
+    fwrite(&node->needs,1,1,output);
+    fwrite(&node->tag_id,sizeof(node->tag_id),1,output);
+    fwrite(&lvl_max,sizeof(lvl_max),1,output);
+    range_save(&node->position,output);
+    if (node->flags&N_EMPTY)
+      return;
+
+    pattern_save(&node->tag,output);
+    range_save(&node->siblings_preceding,output);
+    range_save(&node->siblings_subsequent,output);
+
+    uint64_t l = node->attribsl;
+    fwrite(&l,sizeof(l),1,output);
+    for (size_t i = 0; i < node->attribsl; i++) {
+      struct reliq_pattrib *a = &node->attribs[i];
+      fwrite(&a->flags,1,1,output);
+      pattern_save(&a->r[0],output);
+      if (a->flags&A_VAL_MATTERS)
+        pattern_save(&a->r[1],output);
+      range_save(&a->position,output);
+    }
+
+    l = node->hooksl;
+    fwrite(&l,sizeof(l),1,output);
+    for (size_t i = 0; i < node->hooksl; i++)
+      hook_save(&node->hooks[i],output);
+    l = node->hooksl_cheap;
+    fwrite(&l,sizeof(l),1,output);
+
+    uchar next = node->node ? 1 : 0;
+    fwrite(&next,1,1,output);
+  }
 }
 
-static reliq_error *
-reliq_exec_table(const reliq *rq, const reliq_expr *expr, const reliq_output_field *named, flexarr *source, flexarr *dest, flexarr **out, uchar isempty, uchar noncol, flexarr *ncollector
-    #ifdef RELIQ_EDITING
-    , flexarr *fcollector
-    #endif
-    )
+static int
+node_load(reliq_node *node, const char *ptr, const size_t size, size_t *pos, flexarr *regcache)
 {
-  reliq_error *err = NULL;
-  flexarr *exprs = (flexarr*)expr->e;
-  reliq_expr *exprsv = (reliq_expr*)exprs->v;
-  size_t exprsl = exprs->size;
+  //node has to be zeroed, on failure it's left so that reliq_nfree() can free it
+  while (1) {
+    uint32_t lvl_max;
+    if (load_bytes(&node->flags,1,ptr,size,pos)
+      || load_bytes(&node->needs,1,ptr,size,pos)
+      || load_bytes(&node->tag_id,sizeof(node->tag_id),ptr,size,pos)
+      || load_bytes(&lvl_max,sizeof(lvl_max),ptr,size,pos)
+      || range_load(&node->position,ptr,size,pos))
+      return -1;
+    node->lvl_max = lvl_max;
+    if (node->flags&N_EMPTY)
+      return 0;
 
-  if (expr->flags&EXPR_SINGULAR) {
-    if (named)
-      add_compressed_blank(dest,expr->childfields ? ofArray : ofNoFieldsBlock,named);
-    if (!source->size)
-      goto END;
+    if (pattern_load(&node->tag,ptr,size,pos,regcache)
+      || range_load(&node->siblings_preceding,ptr,size,pos)
+      || range_load(&node->siblings_subsequent,ptr,size,pos)
+      || load_count(&node->attribsl,1,ptr,size,pos))
+      return -1;
+
+    if (node->attribsl)
+      node->attribs = calloc(node->attribsl,sizeof(struct reliq_pattrib));
+    for (size_t i = 0; i < node->attribsl; i++) {
+      struct reliq_pattrib *a = &node->attribs[i];
+      if (load_bytes(&a->flags,1,ptr,size,pos)
+        || pattern_load(&a->r[0],ptr,size,pos,regcache)
+        || (a->flags&A_VAL_MATTERS && pattern_load(&a->r[1],ptr,size,pos,regcache))
+        || range_load(&a->position,ptr,size,pos))
+        return -1;
+    }
 
-    flexarr *in = flexarr_init(sizeof(reliq_compressed),1);
-    reliq_compressed *inv = (reliq_compressed*)flexarr_inc(in);
-    reliq_compressed *sourcev = (reliq_compressed*)source->v;
+    if (load_count(&node->hooksl,1,ptr,size,pos))
+      return -1;
+    if (node->hooksl)
+      node->hooks = calloc(node->hooksl,sizeof(reliq_hook));
+    for (size_t i = 0; i < node->hooksl; i++)
+      if (hook_load(&node->hooks[i],ptr,size,pos,regcache))
+        return -1;
+    uint64_t cheap;
+    if (load_bytes(&cheap,sizeof(cheap),ptr,size,pos) || cheap > node->hooksl)
+      return -1;
+    node->hooksl_cheap = cheap;
+
+    uchar next;
+    if (load_bytes(&next,1,ptr,size,pos))
+      return -1;
+    if (!next)
+      return 0;
+    node = node->node = calloc(1,sizeof(reliq_node));
+  }
+}
+
+static void
+expr_save(const reliq_expr *expr, FILE *output)
+{
+  fwrite(&expr->flags,1,1,output);
+  fwrite(&expr->needs,1,1,output);
+  fwrite(&expr->childfields,sizeof(expr->childfields),1,output);
+
+  const reliq_output_field *o = &expr->outfield;
+  save_str(o->name.b,o->name.b ? o->name.s : 0,output); //length is left from previous field if it's not set
+  fwrite(&o->type,1,1,output);
+  fwrite(&o->arr_delim,1,1,output);
+  fwrite(&o->arr_type,1,1,output);
+  fwrite(&o->isset,1,1,output);
+
+  #ifdef RELIQ_EDITING
+  format_save(expr->nodef,expr->nodefl,output);
+  format_save(expr->exprf,expr->exprfl,output);
+  #else
+  save_str(expr->nodef,expr->nodefl,output);
+  #endif
+
+  if (expr->flags&EXPR_TABLE) {
+    flexarr *e = (flexarr*)expr->e;
+    expr_list_save((reliq_expr*)e->v,e->size,output);
+  } else {
+    uchar isset = expr->e ? 1 : 0;
+    fwrite(&isset,1,1,output);
+    if (isset)
+      node_save((reliq_node*)expr->e,output);
+  }
+}
+
+static int
+expr_load(reliq_expr *expr, const char *ptr, const size_t size, size_t *pos, flexarr *regcache)
+{
+  if (load_bytes(&expr->flags,1,ptr,size,pos)
+    || load_bytes(&expr->needs,1,ptr,size,pos)
+    || load_bytes(&expr->childfields,sizeof(expr->childfields),ptr,size,pos))
+    return -1;
+
+  reliq_output_field *o = &expr->outfield;
+  if (load_str(&o->name,ptr,size,pos)
+    || load_bytes(&o->type,1,ptr,size,pos)
+    || load_bytes(&o->arr_delim,1,ptr,size,pos)
+    || load_bytes(&o->arr_type,1,ptr,size,pos)
+    || load_bytes(&o->isset,1,ptr,size,pos))
+    return -1;
+
+  #ifdef RELIQ_EDITING
+  if (format_load(&expr->nodef,&expr->nodefl,ptr,size,pos)
+    || format_load(&expr->exprf,&expr->exprfl,ptr,size,pos))
+    return -1;
+  #else
+  reliq_str nodef;
+  if (load_str(&nodef,ptr,size,pos))
+    return -1;
+  expr->nodef = nodef.b;
+  expr->nodefl = nodef.s;
+  #endif
+
+  if (expr->flags&EXPR_TABLE) {
+    size_t l;
+    if (load_count(&l,1,ptr,size,pos))
+      return -1;
+    flexarr *e = expr->e = flexarr_init(sizeof(reliq_expr),PATTERN_SIZE_INC);
+    for (size_t i = 0; i < l; i++) {
+      reliq_expr *new = (reliq_expr*)flexarr_inc(e);
+      memset(new,0,sizeof(reliq_expr));
+      if (expr_load(new,ptr,size,pos,regcache))
+        return -1;
+    }
+  } else {
+    uchar isset;
+    if (load_bytes(&isset,1,ptr,size,pos))
+      return -1;
+    if (isset)
+      return node_load(expr->e = calloc(1,sizeof(reliq_node)),ptr,size,pos,regcache);
+  }
+  return 0;
+}
+
+static void
+expr_list_save(const reliq_expr *exprs, const size_t exprsl, FILE *output)
+{
+  uint64_t l = exprsl;
+  fwrite(&l,sizeof(l),1,output);
+  for (size_t i = 0; i < exprsl; i++)
+    expr_save(&exprs[i],output);
+}
+
+static void
+exprs_save(const reliq_exprs *exprs, FILE *output)
+{
+  fwrite(&exprs->needs,1,1,output);
+  expr_list_save(exprs->b,exprs->s,output);
+}
+
+static int
+exprs_load(reliq_exprs *exprs, const char *ptr, const size_t size, size_t *pos, flexarr *regcache)
+{
+  if (load_bytes(&exprs->needs,1,ptr,size,pos)
+    || load_count(&exprs->s,1,ptr,size,pos)) {
+    exprs->s = 0;
+    return -1;
+  }
+  exprs->b = calloc(exprs->s,sizeof(reliq_expr));
+  for (size_t i = 0; i < exprs->s; i++)
+    if (expr_load(&exprs->b[i],ptr,size,pos,regcache))
+      return -1;
+  return 0;
+}
+
+reliq_error *
+reliq_esave(const reliq_exprs *exprs, FILE *output)
+{
+  struct bundle_header h;
+  memset(&h,0,sizeof(h));
+  memcpy(h.magic,RELIQ_BUNDLE_MAGIC,sizeof(h.magic));
+  h.version = BUNDLE_VERSION;
+  h.rangesize = sizeof(struct reliq_range_node);
+  #ifdef RELIQ_EDITING
+  h.editing = 1;
+  #endif
+
+  fwrite(&h,sizeof(h),1,output);
+  exprs_save(exprs,output);
+  if (fflush(output) != 0 || ferror(output))
+    return reliq_set_error(1,"bundle: could not be written");
+  return NULL;
+}
+
+reliq_error *
+reliq_eload(const char *ptr, const size_t size, reliq_exprs *exprs)
+{
+  struct bundle_header h;
+  memset(exprs,0,sizeof(reliq_exprs));
+  if (size < sizeof(h))
+    return reliq_set_error(1,"bundle: too small");
+  memcpy(&h,ptr,sizeof(h));
+  if (memcmp(h.magic,RELIQ_BUNDLE_MAGIC,sizeof(h.magic)) != 0 || h.version != BUNDLE_VERSION
+    || h.rangesize != sizeof(struct reliq_range_node))
+    return reliq_set_error(1,"bundle: incompatible format");
+  #ifdef RELIQ_EDITING
+  if (h.editing != 1)
+  #else
+  if (h.editing != 0)
+  #endif
+    return reliq_set_error(1,"bundle: incompatible format");
+
+  size_t pos = sizeof(h);
+  flexarr *regcache = flexarr_init(sizeof(struct regex_cached),REGCACHE_INC);
+  int r = exprs_load(exprs,ptr,size,&pos,regcache);
+  regcache_free(regcache);
+  if (r || pos != size) {
+    reliq_efree(exprs);
+    memset(exprs,0,sizeof(reliq_exprs));
+    return reliq_set_error(1,"bundle: corrupted");
+  }
+  return NULL;
+}
+
+static void
+dest_match_position(const reliq_range *range, flexarr *dest, size_t start, size_t end) {
+  reliq_compressed *x = (reliq_compressed*)dest->v;
+
+  while (start < end && (void*)x[start].hnode < (void*)10)
+    start++;
+  while (end != start && (void*)x[end-1].hnode < (void*)10)
+    end--;
+
+  size_t found = start;
+  for (size_t i = start; i < end; i++) {
+    if (!range_match(i-start,range,end-start-1))
+      continue;
+    if (found != i)
+      x[found] = x[i];
+    found++;
+  }
+  dest->size = found;
+}
+
+struct first {
+  reliq_node const *node;
+  flexarr *found; //reliq_compressed
+  uchar *tags; //if tag of node matches names of tags, 0 if unknown, NULL if it's always matched
+};
+
+struct firsts_tags {
+  reliq_span names[FIRSTS_TAGS]; //of tags at the same indexes
+  uint table[FIRSTS_TAGS*2]; //index of name plus 1, 0 if slot is empty
+  uint namesl;
+};
+
+static uint
+firsts_tag(const reliq *rq, struct firsts_tags *t, const reliq_chnode *hnode)
+{
+  //returns index of name of tag plus 1, 0 if there are too many of them
+  const char *name = rq->data+hnode->tag.b;
+  const size_t namel = hnode->tag.s;
+  size_t slot = key_hash(KEY_HASH_INIT,name,namel)&(FIRSTS_TAGS*2-1);
+  while (t->table[slot]) {
+    const reliq_span *n = &t->names[t->table[slot]-1];
+    if (memcomp(rq->data+n->b,name,n->s,namel))
+      return t->table[slot];
+    slot = (slot+1)&(FIRSTS_TAGS*2-1);
+  }
+  if (t->namesl == FIRSTS_TAGS)
+    return 0;
+  t->names[t->namesl++] = hnode->tag;
+  return t->table[slot] = t->namesl;
+}
+
+static void
+firsts_collect(const reliq *rq, const reliq_expr *exprs, const size_t exprsl, flexarr *firsts)
+{
+  //finds first nodes of chains that are executed on the whole document
+  for (size_t i = 0; i < exprsl; i++) {
+    if (exprs[i].flags&EXPR_TABLE) {
+      if (!(exprs[i].flags&EXPR_SINGULAR))
+        firsts_collect(rq,(reliq_expr*)((flexarr*)exprs[i].e)->v,((flexarr*)exprs[i].e)->size,firsts);
+      if (exprs[i].flags&EXPR_NEWBLOCK) //next expressions get its results
+        return;
+      continue;
+    }
+    if (!exprs[i].e)
+      return;
+
+    //nodes that can be found from posting lists aren't worth matching with others
+    const reliq_node *node = (reliq_node*)exprs[i].e;
+    size_t candidatesl = 0;
+    uchar indexed = node_tag_candidates(rq,node,&candidatesl) != NULL;
+    for (size_t j = 0; j < node->attribsl && !indexed; j++)
+      indexed = pattrib_indexed(&node->attribs[j]);
+    if (!indexed)
+      *(struct first*)flexarr_inc(firsts) = (struct first){node,NULL,NULL};
+    return;
+  }
+}
+
+static flexarr *
+firsts_find(const reliq *rq, const reliq_exprs *exprs, const size_t exprsl)
+{
+  //first nodes of all expressions are matched in a single pass through nodes,
+  //returns NULL if there would be nothing to share
+  if (!rq->postings)
+    return NULL;
+  flexarr *firsts = flexarr_init(sizeof(struct first),FIRSTS_INC);
+  for (size_t i = 0; i < exprsl; i++)
+    firsts_collect(rq,exprs[i].b,exprs[i].s,firsts);
+  if (firsts->size < 2) {
+    flexarr_free(firsts);
+    return NULL;
+  }
+
+  struct first *firstsv = (struct first*)firsts->v;
+  for (size_t i = 0; i < firsts->size; i++) {
+    firstsv[i].found = flexarr_init(sizeof(reliq_compressed),PASSED_INC);
+    firstsv[i].tags = (firstsv[i].node->flags&N_EMPTY) ? NULL : calloc(FIRSTS_TAGS,1);
+  }
+
+  //tags are compared once for every name, which makes most nodes rejected without matching
+  struct firsts_tags *tags = calloc(1,sizeof(struct firsts_tags));
+  const size_t nodesl = rq->nodesl;
+  for (size_t i = 0; i < nodesl; i++) {
+    const reliq_chnode *hnode = rq->nodes+i;
+    uint tag = firsts_tag(rq,tags,hnode);
+    for (size_t j = 0; j < firsts->size; j++) {
+      struct first *f = &firstsv[j];
+      if (tag && f->tags) {
+        if (!f->tags[tag-1])
+          f->tags[tag-1] = hnode_match_tag(rq,hnode,f->node) ? 2 : 1;
+        if (f->tags[tag-1] == 1)
+          continue;
+      }
+      reliq_match_siblings(rq,rq->nodes+i,NULL,f->node,f->found);
+    }
+  }
+  free(tags);
+  return firsts;
+}
+
+static void
+firsts_free(flexarr *firsts)
+{
+  if (!firsts)
+    return;
+  struct first *firstsv = (struct first*)firsts->v;
+  for (size_t i = 0; i < firsts->size; i++) {
+    flexarr_free(firstsv[i].found);
+    free(firstsv[i].tags);
+  }
+  flexarr_free(firsts);
+}
+
+static const flexarr *
+firsts_get(const reliq *rq, const reliq_node *node)
+{
+  const flexarr *firsts = (const flexarr*)rq->firsts;
+  if (!firsts)
+    return NULL;
+  const struct first *firstsv = (const struct first*)firsts->v;
+  for (size_t i = 0; i < firsts->size; i++)
+    if (firstsv[i].node == node)
+      return firstsv[i].found;
+  return NULL;
+}
+
+static void
+node_exec_source(const reliq *rq, const reliq_node *node, reliq_chnode *current, const uint *candidates, const size_t candidatesl, flexarr *dest)
+{
+  //matches subtree of current
+  size_t prevdestsize = dest->size;
+  if (candidates && current->child_count >= POSTINGS_SUBTREE_MIN && current >= rq->nodes && current < rq->nodes+rq->nodesl) {
+    //only nodes of list that are in subtree of current
+    size_t first = current-rq->nodes, last = first+current->child_count;
+    size_t l = 0, r = candidatesl;
+    while (l < r) {
+      size_t m = l+(r-l)/2;
+      if (candidates[m] < first) {
+        l = m+1;
+      } else
+        r = m;
+    }
+    for (; l < candidatesl && candidates[l] <= last; l++)
+      reliq_match_siblings(rq,rq->nodes+candidates[l],current,node,dest);
+  } else for (size_t j = 0; j <= current->child_count; j++)
+    reliq_match_siblings(rq,current+j,current,node,dest);
+
+  if (!(node->flags&N_POSITION_ABSOLUTE) && node->position.s)
+    dest_match_position(&node->position,dest,prevdestsize,dest->size);
+}
+
+struct match_chunk {
+  uint worker; //that matched it
+  size_t start; //of its matches in found of worker
+  size_t end;
+};
+
+struct match_worker {
+  const reliq *rq;
+  const reliq_node *node;
+  const uint *candidates; //indexes of nodes, all of them are matched if it's NULL
+  size_t candidatesl;
+  const reliq_compressed *sources; //if set, subtrees of them are matched instead of nodes
+  size_t size; //of sources, candidates or nodes
+  size_t chunk; //number of them taken at once
+  size_t *next; //chunk that hasn't been taken yet
+  pthread_mutex_t *lock; //of next
+  struct match_chunk *chunks;
+  flexarr *found; //reliq_compressed
+  uint id;
+};
+
+static void *
+match_worker_run(void *arg)
+{
+  struct match_worker *w = (struct match_worker*)arg;
+  reliq_chnode *nodes = w->rq->nodes;
+  while (1) {
+    pthread_mutex_lock(w->lock);
+    size_t chunk = (*w->next)++;
+    pthread_mutex_unlock(w->lock);
+    size_t start = chunk*w->chunk;
+    if (start >= w->size)
+      break;
+    size_t end = (start+w->chunk < w->size) ? start+w->chunk : w->size;
+
+    w->chunks[chunk] = (struct match_chunk){w->id,w->found->size,0};
+    for (size_t i = start; i < end; i++) {
+      if (w->sources) {
+        reliq_chnode *current = w->sources[i].hnode;
+        if ((void*)current >= (void*)10)
+          node_exec_source(w->rq,w->node,current,w->candidates,w->candidatesl,w->found);
+      } else
+        reliq_match_siblings(w->rq,nodes+(w->candidates ? w->candidates[i] : i),NULL,w->node,w->found);
+    }
+    w->chunks[chunk].end = w->found->size;
+  }
+  return NULL;
+}
+
+static uchar
+match_parallel(struct match_worker *w, flexarr *dest)
+{
+  //items are split into chunks matched by threads, their matches are joined in order of chunks,
+  //returns 0 if it wasn't done
+  const reliq *rq = w->rq;
+  uint threads = rq->threads;
+  if (threads < 2 || !rq->postings
+    || (rq->flags&RELIQ_ATTRIBS_LAZY && w->node->needs&RELIQ_NEEDS_ATTRIBS)) //cache of lazy attribs is changed when they're read
+    return 0;
+
+  size_t chunksl = (w->size+w->chunk-1)/w->chunk;
+  if (threads > chunksl)
+    threads = chunksl;
+  if (threads < 2)
+    return 0;
+  struct match_chunk *chunks = malloc(chunksl*sizeof(struct match_chunk));
+  struct match_worker *workers = malloc(threads*sizeof(struct match_worker));
+  pthread_t *ids = malloc(threads*sizeof(pthread_t));
+  pthread_mutex_t lock;
+  pthread_mutex_init(&lock,NULL);
+  size_t next = 0;
+
+  //lazy parts of postings are only read by threads
+  struct postings *p = (struct postings*)rq->postings;
+  p->shared = 1;
+  uint started = 0;
+  for (uint i = 0; i < threads; i++) {
+    workers[i] = *w;
+    workers[i].next = &next;
+    workers[i].lock = &lock;
+    workers[i].chunks = chunks;
+    workers[i].found = flexarr_init(sizeof(reliq_compressed),PASSED_INC);
+    workers[i].id = i;
+    if (i && pthread_create(&ids[i],NULL,match_worker_run,&workers[i]) != 0) {
+      flexarr_free(workers[i].found);
+      break;
+    }
+    started = i+1;
+  }
+  match_worker_run(&workers[0]);
+  for (uint i = 1; i < started; i++)
+    pthread_join(ids[i],NULL);
+  p->shared = 0;
+
+  for (size_t i = 0; i < chunksl; i++) {
+    const flexarr *found = workers[chunks[i].worker].found;
+    size_t n = chunks[i].end-chunks[i].start;
+    if (!n)
+      continue;
+    flexarr_alloc(dest,n);
+    memcpy((reliq_compressed*)dest->v+dest->size,(reliq_compressed*)found->v+chunks[i].start,n*sizeof(reliq_compressed));
+    dest->size += n;
+  }
+
+  for (uint i = 0; i < started; i++)
+    flexarr_free(workers[i].found);
+  pthread_mutex_destroy(&lock);
+  free(chunks);
+  free(workers);
+  free(ids);
+  return 1;
+}
+
+static void
+node_exec_first(const reliq *rq, reliq_node *node, flexarr *dest)
+{
+  size_t candidatesl = 0;
+  const flexarr *found = firsts_get(rq,node);
+  const uint *candidates = found ? NULL : node_candidates(rq,node,&candidatesl);
+  size_t size = candidates ? candidatesl : rq->nodesl;
+  struct match_worker w = {rq,node,candidates,size,NULL,size,PARALLEL_CHUNK,NULL,NULL,NULL,NULL,0};
+  if (found) {
+    flexarr_add(dest,found);
+  } else if (size >= PARALLEL_MIN_NODES && match_parallel(&w,dest)) {
+    ;
+  } else if (candidates) {
+    for (size_t i = 0; i < candidatesl; i++)
+      reliq_match_siblings(rq,rq->nodes+candidates[i],NULL,node,dest);
+  } else {
+    size_t nodesl = rq->nodesl;
+    for (size_t i = 0; i < nodesl; i++)
+      reliq_match_siblings(rq,rq->nodes+i,NULL,node,dest);
+  }
+
+  if (node->position.s)
+    dest_match_position(&node->position,dest,0,dest->size);
+}
+
+static uchar
+node_exec_parallel(const reliq *rq, const reliq_node *node, const uint *candidates, const size_t candidatesl, const flexarr *source, flexarr *dest)
+{
+  //sources are matched by threads if their subtrees are big enough
+  if (rq->threads < 2 || source->size < 2)
+    return 0;
+  const reliq_compressed *sourcev = (reliq_compressed*)source->v;
+  size_t nodes = 0;
+  for (size_t i = 0; i < source->size && nodes < PARALLEL_MIN_NODES; i++)
+    if ((void*)sourcev[i].hnode >= (void*)10)
+      nodes += sourcev[i].hnode->child_count+1;
+  if (nodes < PARALLEL_MIN_NODES)
+    return 0;
+
+  struct match_worker w = {rq,node,candidates,candidatesl,sourcev,source->size,PARALLEL_SOURCES_CHUNK,NULL,NULL,NULL,NULL,0};
+  return match_parallel(&w,dest);
+}
+
+static void
+node_exec(const reliq *rq, reliq_node *node, flexarr *source, flexarr *dest)
+{
+  if (source->size == 0) {
+    node_exec_first(rq,node,dest);
+    return;
+  }
+
+  size_t candidatesl = 0;
+  const uint *candidates = node_tag_candidates(rq,node,&candidatesl);
+  if (!node_exec_parallel(rq,node,candidates,candidatesl,source,dest)) {
+    for (size_t i = 0; i < source->size; i++) {
+      reliq_chnode *current = ((reliq_compressed*)source->v)[i].hnode;
+      if ((void*)current < (void*)10)
+        continue;
+      node_exec_source(rq,node,current,candidates,candidatesl,dest);
+    }
+  }
+  if (node->flags&N_POSITION_ABSOLUTE && node->position.s)
+    dest_match_position(&node->position,dest,0,dest->size);
+}
+
+/*static reliq_error *
+ncollector_check(flexarr *ncollector, size_t correctsize)
+{
+  size_t ncollector_sum = 0;
+  reliq_cstr *pcol = (reliq_cstr*)ncollector->v;
+  for (size_t j = 0; j < ncollector->size; j++)
+    ncollector_sum += pcol[j].s;
+  if (ncollector_sum != correctsize)
+    return reliq_set_error(1,"ncollector does not match count of found tags, %lu != %lu",ncollector_sum,correctsize);
+  return NULL;
+}*/
+
+static void
+ncollector_add(flexarr *ncollector, flexarr *dest, flexarr *source, size_t startn, size_t lastn, const reliq_expr *lastnode, uchar istable, uchar useformat, uchar isempty, uchar non)
+{
+  if (!source->size && !isempty)
+    return;
+  size_t prevsize = dest->size;
+  flexarr_add(dest,source);
+  if (non || (useformat && !lastnode))
+    goto END;
+  if (istable&EXPR_TABLE && !isempty) {
+    if (startn != lastn) { //truncate previously added, now useless ncollector
+      for (size_t i = lastn; i < ncollector->size; i++)
+        ((reliq_cstr*)ncollector->v)[startn+i] = ((reliq_cstr*)ncollector->v)[i];
+      ncollector->size -= lastn-startn;
+    }
+  } else {
+    ncollector->size = startn;
+    *(reliq_cstr*)flexarr_inc(ncollector) = (reliq_cstr){(char const*)lastnode,dest->size-prevsize};
+  }
+  END: ;
+  source->size = 0;
+}
+
+#ifdef RELIQ_EDITING
+static void
+fcollector_add(const size_t lastn, const uchar isnodef, const reliq_expr *expr, flexarr *ncollector, flexarr *fcollector)
+{
+  struct fcollector_expr *fcols = (struct fcollector_expr*)fcollector->v;
+  for (size_t i = fcollector->size; i > 0; i--) {
+    if (fcols[i-1].start < lastn)
+      break;
+    fcols[i-1].lvl++;
+  }
+  *(struct fcollector_expr*)flexarr_inc(fcollector) = (struct fcollector_expr){expr,lastn,ncollector->size-1,0,isnodef};
+}
+#endif
+
+static void
+add_compressed_blank(flexarr *dest, const enum outfieldCode val1, const void *val2)
+{
+  reliq_compressed *x = flexarr_inc(dest);
+  x->hnode = (reliq_chnode *const)val1;
+  x->parent = (void *const)val2;
+}
+
+static reliq_error *
+reliq_exec_table(const reliq *rq, const reliq_expr *expr, const reliq_output_field *named, flexarr *source, flexarr *dest, flexarr **out, uchar isempty, uchar noncol, flexarr *ncollector
+    #ifdef RELIQ_EDITING
+    , flexarr *fcollector
+    #endif
+    )
+{
+  reliq_error *err = NULL;
+  flexarr *exprs = (flexarr*)expr->e;
+  reliq_expr *exprsv = (reliq_expr*)exprs->v;
+  size_t exprsl = exprs->size;
+
+  if (expr->flags&EXPR_SINGULAR) {
+    if (named)
+      add_compressed_blank(dest,expr->childfields ? ofArray : ofNoFieldsBlock,named);
+    if (!source->size)
+      goto END;
+
+    flexarr *in = flexarr_init(sizeof(reliq_compressed),1);
+    reliq_compressed *inv = (reliq_compressed*)flexarr_inc(in);
+    reliq_compressed *sourcev = (reliq_compressed*)source->v;
 
     for (size_t i = 0; i < source->size; i++) {
       *inv = sourcev[i];
@@ -1998,6 +3741,10 @@ reliq_exec_r(reliq *rq, FILE *output, reliq_compressed **outnodes, size_t *outno
   rq->output = output;
   reliq_error *err;
 
+  flexarr *firsts = NULL;
+  if (!rq->firsts) //unless they were already found for many expressions by reliq_exec_files()
+    rq->firsts = firsts = firsts_find(rq,exprs,1);
+
   flexarr *ncollector = flexarr_init(sizeof(reliq_cstr),NCOLLECTOR_INC);
   #ifdef RELIQ_EDITING
   flexarr *fcollector = flexarr_init(sizeof(struct fcollector_expr),FCOLLECTOR_INC);
@@ -2021,6 +3768,10 @@ reliq_exec_r(reliq *rq, FILE *output, reliq_compressed **outnodes, size_t *outno
   #ifdef RELIQ_EDITING
   flexarr_free(fcollector);
   #endif
+  if (firsts) {
+    firsts_free(firsts);
+    rq->firsts = NULL;
+  }
   return err;
 }
 
@@ -2047,13 +3798,29 @@ reliq_exec_str(reliq *rq, char **str, size_t *strl, const reliq_exprs *exprs)
   return err;
 }
 
+reliq_error *
+reliq_exec_files(reliq *rq, FILE **outputs, const reliq_exprs *exprs, const size_t exprsl)
+{
+  //expressions are executed separately, but their first nodes are matched together
+  reliq_error *err = NULL;
+  flexarr *firsts = firsts_find(rq,exprs,exprsl);
+  rq->firsts = firsts;
+  for (size_t i = 0; i < exprsl; i++)
+    if ((err = reliq_exec_file(rq,outputs[i],&exprs[i])))
+      break;
+  firsts_free(firsts);
+  rq->firsts = NULL;
+  return err;
+}
+
 static reliq_error *
 reliq_analyze(const char *ptr, const size_t size, flexarr *nodes, reliq *rq)
 {
   reliq_error *err;
+  if (size > RELIQ_SIZE_MAX)
+    return reliq_set_error(1,"data: size %lu exceeds the limit of %lu",size,(ulong)RELIQ_SIZE_MAX);
   for (size_t i = 0; i < size; i++) {
-    while (i < size && ptr[i] != '<')
-        i++;
+    i = sindex_next((struct sindex*)rq->sindex,ptr,i,size,'<');
     while (i < size && ptr[i] == '<') {
       html_struct_handle(ptr,&i,size,0,nodes,rq,&err);
       if (err)
@@ -2070,7 +3837,7 @@ reliq_fmatch(const char *ptr, const size_t size, FILE *output, const reliq_node
 #else
   char *nodef,
 #endif
-  size_t nodefl)
+  size_t nodefl, const uchar needs)
 {
   reliq t;
   t.data = ptr;
@@ -2084,38 +3851,39 @@ reliq_fmatch(const char *ptr, const size_t size, FILE *output, const reliq_node
   t.output = output;
   t.nodes = NULL;
   t.nodesl = 0;
-
-  flexarr *nodes = flexarr_init(sizeof(reliq_hnode),RELIQ_NODES_INC);
-  t.attrib_buffer = (void*)flexarr_init(sizeof(reliq_cstr_pair),ATTRIB_INC);
+  t.attribs = NULL;
+  t.attribsl = 0;
+  t.sindex = NULL;
+  t.parallel = NULL;
+  t.postings = NULL;
+  t.firsts = NULL;
+  t.threads = 0;
+
+  flexarr *nodes = flexarr_init(sizeof(reliq_chnode),RELIQ_NODES_INC);
+  //parser skips attribs if there is no buffer for them
+  t.attrib_buffer = (needs&RELIQ_NEEDS_ATTRIBS) ? (void*)flexarr_init(sizeof(reliq_span_pair),ATTRIB_INC) : NULL;
 
   reliq_error *err = reliq_analyze(ptr,size,nodes,&t);
 
   flexarr_free(nodes);
-  flexarr_free((flexarr*)t.attrib_buffer);
+  if (t.attrib_buffer)
+    flexarr_free((flexarr*)t.attrib_buffer);
   return err;
 }
 
-reliq_error *
-reliq_fexec_file(char *ptr, size_t size, FILE *output, const reliq_exprs *exprs, int (*freeptr)(void *ptr, size_t size))
+static reliq_error *
+reliq_fexec_chain(char *ptr, size_t size, FILE *destination, const reliq_expr *chainv, const size_t chainl, int (*freeptr)(void *ptr, size_t size))
 {
-  if (exprs->s == 0)
-    return NULL;
   reliq_error *err;
-  if ((err = exprs_check_chain(exprs)))
-    return err;
-
-  FILE *destination = output;
+  FILE *output;
   char *nptr;
   size_t fsize;
 
-  flexarr *chain = (flexarr*)exprs->b[0].e;
-  reliq_expr *chainv = (reliq_expr*)chain->v;
-
-  for (size_t i = 0; i < chain->size; i++) {
-    output = (i == chain->size-1) ? destination : open_memstream(&nptr,&fsize);
+  for (size_t i = 0; i < chainl; i++) {
+    output = (i == chainl-1) ? destination : open_memstream(&nptr,&fsize);
 
     err = reliq_fmatch(ptr,size,output,(reliq_node*)chainv[i].e,
-      chainv[i].nodef,chainv[i].nodefl);
+      chainv[i].nodef,chainv[i].nodefl,chainv[i].needs);
 
     fflush(output);
 
@@ -2125,7 +3893,7 @@ reliq_fexec_file(char *ptr, size_t size, FILE *output, const reliq_exprs *exprs,
     } else
       free(ptr);
 
-    if (i != chain->size-1)
+    if (i != chainl-1)
       fclose(output);
 
     if (err)
@@ -2137,6 +3905,19 @@ reliq_fexec_file(char *ptr, size_t size, FILE *output, const reliq_exprs *exprs,
   return NULL;
 }
 
+reliq_error *
+reliq_fexec_file(char *ptr, size_t size, FILE *output, const reliq_exprs *exprs, int (*freeptr)(void *ptr, size_t size))
+{
+  if (exprs->s == 0)
+    return NULL;
+  reliq_error *err;
+  if ((err = exprs_check_chain(exprs)))
+    return err;
+
+  flexarr *chain = (flexarr*)exprs->b[0].e;
+  return reliq_fexec_chain(ptr,size,output,(reliq_expr*)chain->v,chain->size,freeptr);
+}
+
 reliq_error *
 reliq_fexec_str(char *ptr, size_t size, char **str, size_t *strl, const reliq_exprs *exprs, int (*freeptr)(void *ptr, size_t size))
 {
@@ -2146,48 +3927,199 @@ reliq_fexec_str(char *ptr, size_t size, char **str, size_t *strl, const reliq_ex
   return err;
 }
 
-static void
-reliq_hnode_shift(reliq_hnode *node, const size_t pos)
+reliq_error *
+reliq_stream_init(reliq_stream *stream, FILE *output, const reliq_exprs *exprs)
+{
+  memset(stream,0,sizeof(reliq_stream));
+  if (output == NULL)
+    output = stdout;
+  stream->destination = output;
+  stream->exprs = exprs;
+  if (exprs->s == 0)
+    return NULL;
+  reliq_error *err;
+  if ((err = exprs_check_chain(exprs)))
+    return err;
+
+  flexarr *chain = (flexarr*)exprs->b[0].e;
+  reliq_expr *chainv = (reliq_expr*)chain->v;
+  reliq *rq = &stream->rq;
+  rq->expr = (reliq_node*)chainv[0].e;
+  rq->nodef = chainv[0].nodef;
+  rq->nodefl = chainv[0].nodefl;
+  rq->flags = RELIQ_STREAM;
+  rq->output = (chain->size == 1) ? output : open_memstream(&stream->chain_output,&stream->chain_outputl);
+  stream->nodes = (void*)flexarr_init(sizeof(reliq_chnode),RELIQ_NODES_INC);
+  if (chainv[0].needs&RELIQ_NEEDS_ATTRIBS)
+    rq->attrib_buffer = (void*)flexarr_init(sizeof(reliq_span_pair),ATTRIB_INC);
+  return NULL;
+}
+
+static reliq_error *
+reliq_stream_parse(reliq_stream *stream)
 {
-  char const *ref = node->all.b;
-  #define shift_cstr(x) x.b = (char const*)(x.b-ref)+pos
+  reliq *rq = &stream->rq;
+  char const *ptr = stream->buffer;
+  size_t size = stream->bufferl;
+  reliq_error *err = NULL;
+  rq->data = ptr;
+  rq->size = size;
+  if (size > RELIQ_SIZE_MAX)
+    return reliq_set_error(1,"data: size %lu exceeds the limit of %lu",size,(ulong)RELIQ_SIZE_MAX);
 
-  shift_cstr(node->all);
-  shift_cstr(node->tag);
-  shift_cstr(node->insides);
-  for (size_t i = 0; i < node->attribsl; i++) {
-    shift_cstr(node->attribs[i].f);
-    shift_cstr(node->attribs[i].s);
+  //same as reliq_analyze() but stops at top level node whose parsing depended on the end of data
+  size_t i = 0;
+  while (1) {
+    char const *lt = memchr(ptr+i,'<',size-i);
+    if (!lt) {
+      i = size;
+      break;
+    }
+    i = lt-ptr;
+
+    size_t start = i;
+    stream->matched = 0;
+    stream->edge = 0;
+    html_struct_handle(ptr,&i,size,0,(flexarr*)stream->nodes,rq,&err);
+    if (err)
+      break;
+    if (stream->edge && !stream->end) {
+      stream->tried = size-start;
+      i = start;
+      break;
+    }
+    stream->written = 0;
+    stream->tried = 0;
+
+    if (i >= size)
+      break;
+    if (ptr[i] != '<')
+      i++;
+  }
+
+  if (i > size)
+    i = size;
+  stream->offset += i;
+  stream->bufferl -= i;
+  if (i)
+    memmove(stream->buffer,stream->buffer+i,stream->bufferl);
+  return err;
+}
+
+reliq_error *
+reliq_stream_feed(reliq_stream *stream, const char *ptr, const size_t size)
+{
+  if (!stream->nodes || !size)
+    return NULL;
+
+  if (stream->bufferl+size >= stream->buffers) {
+    size_t s = stream->buffers ? stream->buffers : size;
+    while (s <= stream->bufferl+size)
+      s <<= 1;
+    stream->buffer = realloc(stream->buffer,s);
+    stream->buffers = s;
   }
+  memcpy(stream->buffer+stream->bufferl,ptr,size);
+  stream->bufferl += size;
+  stream->buffer[stream->bufferl] = 0; //parser may look one byte past the data
+
+  //parsing of unfinished node is repeated only after its data doubles
+  if (stream->tried && stream->bufferl < stream->tried<<1)
+    return NULL;
+  return reliq_stream_parse(stream);
+}
+
+reliq_error *
+reliq_stream_finish(reliq_stream *stream)
+{
+  reliq *rq = &stream->rq;
+  if (!stream->nodes)
+    return NULL;
+
+  stream->end = 1;
+  reliq_error *err = NULL;
+  if (stream->bufferl)
+    err = reliq_stream_parse(stream);
+  fflush(rq->output);
+
+  flexarr_free((flexarr*)stream->nodes);
+  if (rq->attrib_buffer)
+    flexarr_free((flexarr*)rq->attrib_buffer);
+  if (stream->buffer)
+    free(stream->buffer);
+
+  flexarr *chain = (flexarr*)stream->exprs->b[0].e;
+  if (chain->size > 1) {
+    fclose(rq->output);
+    if (!err)
+      err = reliq_fexec_chain(stream->chain_output,stream->chain_outputl,stream->destination,
+        (reliq_expr*)chain->v+1,chain->size-1,NULL);
+    free(stream->chain_output);
+  }
+
+  memset(stream,0,sizeof(reliq_stream));
+  return err;
 }
 
 static void
-reliq_hnode_shift_finalize(reliq_hnode *node, char *ref)
+reliq_chnode_shift(reliq_chnode *node, reliq_span_pair *attribs, const size_t ref, const size_t pos)
 {
-  #define shift_cstr_p(x) x.b = ref+(size_t)x.b
+  #define shift_span(x) x.b = x.b-ref+pos
 
-  shift_cstr_p(node->all);
-  shift_cstr_p(node->tag);
-  shift_cstr_p(node->insides);
+  shift_span(node->all);
+  shift_span(node->tag);
+  shift_span(node->insides);
+  if (!attribs) { //lazy attribs are position in data
+    node->attribs = node->attribs-ref+pos;
+    return;
+  }
   for (size_t i = 0; i < node->attribsl; i++) {
-    shift_cstr_p(node->attribs[i].f);
-    shift_cstr_p(node->attribs[i].s);
+    shift_span(attribs[i].f);
+    shift_span(attribs[i].s);
   }
 }
 
+static void
+root_link(flexarr *nodes, const size_t index, size_t *last)
+{
+  //copied nodes become siblings at the top
+  reliq_chnode *hnode = (reliq_chnode*)nodes->v+index;
+  hnode->parent = 0;
+  hnode->prev = index ? index-*last : 0;
+  *last = index;
+}
+
+static size_t
+attribs_add(flexarr *attribs, const reliq *rq, const reliq_chnode *hnode)
+{
+  //attribs of node and its descendants are next to each other, returns their position
+  if (rq->flags&RELIQ_ATTRIBS_LAZY)
+    return hnode->attribs;
+  const reliq_chnode *last = hnode+hnode->child_count;
+  size_t size = (last->attribs+last->attribsl)-hnode->attribs;
+  size_t ret = attribs->size;
+  if (!size)
+    return ret;
+  flexarr_alloc(attribs,size);
+  memcpy(attribs->v+(ret*attribs->elsize),rq->attribs+hnode->attribs,size*attribs->elsize);
+  attribs->size += size;
+  return ret;
+}
+
 reliq
-reliq_from_compressed_independent(const reliq_compressed *compressed, const size_t compressedl, char **ptr, size_t *size)
+reliq_from_compressed_independent(const reliq_compressed *compressed, const size_t compressedl, const reliq *rq, char **ptr, size_t *size)
 {
   reliq t;
   t.expr = NULL;
-  t.flags = RELIQ_SAVE;
+  t.flags = RELIQ_SAVE|(rq->flags&RELIQ_ATTRIBS_LAZY);
   t.output = NULL;
 
-  size_t pos=0;
+  size_t pos=0,root=0;
   ushort lvl;
   FILE *out = open_memstream(ptr,size);
-  flexarr *nodes = flexarr_init(sizeof(reliq_hnode),RELIQ_NODES_INC);
-  reliq_hnode *current,*new;
+  flexarr *nodes = flexarr_init(sizeof(reliq_chnode),RELIQ_NODES_INC);
+  flexarr *attribs = flexarr_init(sizeof(reliq_span_pair),RELIQ_ATTRIBS_INC);
+  reliq_chnode *current,*new;
 
   for (size_t i = 0; i < compressedl; i++) {
     current = compressed[i].hnode;
@@ -2195,31 +4127,31 @@ reliq_from_compressed_independent(const reliq_compressed *compressed, const size
       continue;
 
     lvl = current->lvl;
+    size_t apos = attribs_add(attribs,rq,current);
 
     for (size_t j = 0; j <= current->child_count; j++) {
-      new = (reliq_hnode*)flexarr_inc(nodes);
-      memcpy(new,current+j,sizeof(reliq_hnode));
-
-      new->attribs = NULL;
-      if ((current+j)->attribsl)
-        new->attribs = memdup((current+j)->attribs,sizeof(reliq_cstr_pair)*(current+j)->attribsl);
+      new = (reliq_chnode*)flexarr_inc(nodes);
+      memcpy(new,current+j,sizeof(reliq_chnode));
 
-      size_t tpos = pos+(new->all.b-current->all.b);
-
-      reliq_hnode_shift(new,tpos);
+      new->attribs = apos+(new->attribs-current->attribs);
+      reliq_chnode_shift(new,(rq->flags&RELIQ_ATTRIBS_LAZY) ? NULL : (reliq_span_pair*)attribs->v+new->attribs,current->all.b,pos);
       new->lvl -= lvl;
     }
+    root_link(nodes,nodes->size-current->child_count-1,&root);
 
-    fwrite(current->all.b,1,current->all.s,out);
+    fwrite(rq->data+current->all.b,1,current->all.s,out);
     pos += current->all.s;
   }
 
   fclose(out);
 
-  for (size_t i = 0; i < nodes->size; i++)
-    reliq_hnode_shift_finalize(&((reliq_hnode*)nodes->v)[i],*ptr);
-
   flexarr_conv(nodes,(void**)&t.nodes,&t.nodesl);
+  flexarr_conv(attribs,(void**)&t.attribs,&t.attribsl);
+  t.attrib_buffer = (t.flags&RELIQ_ATTRIBS_LAZY) ? attribs_cache_init(t.nodes,t.nodesl) : NULL;
+  t.postings = postings_init(t.nodes,t.nodesl);
+  t.firsts = NULL;
+  t.threads = 0;
+
   t.data = *ptr;
   t.size = *size;
   return t;
@@ -2230,14 +4162,16 @@ reliq_from_compressed(const reliq_compressed *compressed, const size_t compresse
 {
   reliq t;
   t.expr = NULL;
-  t.flags = RELIQ_SAVE;
+  t.flags = RELIQ_SAVE|(rq->flags&RELIQ_ATTRIBS_LAZY);
   t.output = NULL;
   t.data = rq->data;
   t.size = rq->size;
 
   ushort lvl;
-  flexarr *nodes = flexarr_init(sizeof(reliq_hnode),RELIQ_NODES_INC);
-  reliq_hnode *current,*new;
+  size_t root=0;
+  flexarr *nodes = flexarr_init(sizeof(reliq_chnode),RELIQ_NODES_INC);
+  flexarr *attribs = flexarr_init(sizeof(reliq_span_pair),RELIQ_ATTRIBS_INC);
+  reliq_chnode *current,*new;
 
   for (size_t i = 0; i < compressedl; i++) {
     current = compressed[i].hnode;
@@ -2245,39 +4179,312 @@ reliq_from_compressed(const reliq_compressed *compressed, const size_t compresse
       continue;
 
     lvl = current->lvl;
+    size_t apos = attribs_add(attribs,rq,current);
 
     for (size_t j = 0; j <= current->child_count; j++) {
-      new = (reliq_hnode*)flexarr_inc(nodes);
-      memcpy(new,current+j,sizeof(reliq_hnode));
-
-      new->attribs = NULL;
-      if ((current+j)->attribsl)
-        new->attribs = memdup((current+j)->attribs,sizeof(reliq_cstr_pair)*(current+j)->attribsl);
+      new = (reliq_chnode*)flexarr_inc(nodes);
+      memcpy(new,current+j,sizeof(reliq_chnode));
 
+      new->attribs = apos+(new->attribs-current->attribs);
       new->lvl -= lvl;
     }
+    root_link(nodes,nodes->size-current->child_count-1,&root);
   }
 
   flexarr_conv(nodes,(void**)&t.nodes,&t.nodesl);
+  flexarr_conv(attribs,(void**)&t.attribs,&t.attribsl);
+  t.attrib_buffer = (t.flags&RELIQ_ATTRIBS_LAZY) ? attribs_cache_init(t.nodes,t.nodesl) : NULL;
+  t.postings = postings_init(t.nodes,t.nodesl);
+  t.firsts = NULL;
+  t.threads = 0;
+  return t;
+}
+
+static void
+attribs_buffer_init(reliq *rq)
+{
+  //lazy attribs aren't stored at parsing
+  rq->attrib_buffer = (rq->flags&RELIQ_ATTRIBS_LAZY) ? NULL : (void*)flexarr_init(sizeof(reliq_span_pair),RELIQ_ATTRIBS_INC);
+}
+
+static void
+attribs_buffer_conv(reliq *rq)
+{
+  rq->postings = postings_init(rq->nodes,rq->nodesl);
+  rq->firsts = NULL;
+  rq->threads = 0;
+  if (rq->flags&RELIQ_ATTRIBS_LAZY) {
+    rq->attribs = NULL;
+    rq->attribsl = 0;
+    rq->attrib_buffer = attribs_cache_init(rq->nodes,rq->nodesl);
+    return;
+  }
+  flexarr_conv((flexarr*)rq->attrib_buffer,(void**)&rq->attribs,&rq->attribsl);
+  rq->attrib_buffer = NULL;
+}
+
+static reliq
+reliq_init_sequential(const char *ptr, const size_t size, const uchar flags)
+{
+  reliq t;
+  t.data = ptr;
+  t.size = size;
+  t.expr = NULL;
+  t.flags = RELIQ_SAVE|flags;
+  t.output = NULL;
+
+  struct sindex sindex;
+  sindex_build(&sindex,ptr,size);
+  t.sindex = &sindex;
+  t.parallel = NULL;
+
+  flexarr *nodes = flexarr_init(sizeof(reliq_chnode),RELIQ_NODES_INC);
+  if (sindex.count) //every node starts with '<' so it's allocated only once
+    flexarr_set(nodes,sindex.count);
+  attribs_buffer_init(&t);
+
+  reliq_analyze(ptr,size,nodes,&t);
+
+  flexarr_conv(nodes,(void**)&t.nodes,&t.nodesl);
+  attribs_buffer_conv(&t);
+  sindex_free(&sindex);
+  t.sindex = NULL;
   return t;
 }
 
 reliq
 reliq_init(const char *ptr, const size_t size)
 {
+  return reliq_init_sequential(ptr,size,0);
+}
+
+struct parallel_worker {
+  const char *ptr;
+  size_t start;
+  size_t end;
+  struct sindex *sindex;
+  uchar flags;
+  struct html_fragments fragments;
+};
+
+static void *
+parallel_worker_run(void *arg)
+{
+  struct parallel_worker *w = (struct parallel_worker*)arg;
+  html_fragments_parse(w->ptr,w->start,w->end,w->sindex,w->flags,&w->fragments);
+  return NULL;
+}
+
+static reliq
+reliq_init_threads(const char *ptr, const size_t size, const uint threads, const uchar flags)
+{
+  if (threads < 2 || size < threads*PARALLEL_MIN_SIZE || size > RELIQ_SIZE_MAX)
+    return reliq_init_sequential(ptr,size,flags);
+
   reliq t;
   t.data = ptr;
   t.size = size;
   t.expr = NULL;
-  t.flags = RELIQ_SAVE;
+  t.flags = RELIQ_SAVE|flags;
   t.output = NULL;
 
-  flexarr *nodes = flexarr_init(sizeof(reliq_hnode),RELIQ_NODES_INC);
-  t.attrib_buffer = (void*)flexarr_init(sizeof(reliq_cstr_pair),ATTRIB_INC);
+  struct sindex sindex;
+  sindex_build(&sindex,ptr,size);
+  t.sindex = &sindex;
+
+  //every thread parses siblings in its part without knowing their ancestors, then
+  //they are joined by the sequential parser wherever it gets the same result
+  struct parallel_worker *workers = malloc(threads*sizeof(struct parallel_worker));
+  pthread_t *ids = malloc(threads*sizeof(pthread_t));
+  uint started = 0;
+  for (uint i = 0; i < threads; i++) {
+    workers[i].ptr = ptr;
+    workers[i].start = (size/threads)*i;
+    workers[i].end = (i == threads-1) ? size : (size/threads)*(i+1);
+    workers[i].sindex = &sindex;
+    workers[i].flags = flags;
+    if (i && pthread_create(&ids[i],NULL,parallel_worker_run,&workers[i]) != 0)
+      break;
+    started = i+1;
+  }
+  parallel_worker_run(&workers[0]);
+  for (uint i = 1; i < started; i++)
+    pthread_join(ids[i],NULL);
+
+  struct html_fragments *fragments = malloc(started*sizeof(struct html_fragments));
+  for (uint i = 0; i < started; i++)
+    fragments[i] = workers[i].fragments;
+  free(workers);
+  free(ids);
+
+  struct html_parallel parallel;
+  memset(&parallel,0,sizeof(parallel));
+  parallel.fragments = fragments;
+  parallel.fragmentsl = started;
+  t.parallel = &parallel;
+
+  flexarr *nodes = flexarr_init(sizeof(reliq_chnode),RELIQ_NODES_INC);
+  if (sindex.count)
+    flexarr_set(nodes,sindex.count);
+  attribs_buffer_init(&t);
 
   reliq_analyze(ptr,size,nodes,&t);
 
   flexarr_conv(nodes,(void**)&t.nodes,&t.nodesl);
-  flexarr_free((flexarr*)t.attrib_buffer);
+  attribs_buffer_conv(&t);
+  for (uint i = 0; i < started; i++)
+    html_fragments_free(&fragments[i]);
+  free(fragments);
+  sindex_free(&sindex);
+  t.sindex = NULL;
+  t.parallel = NULL;
   return t;
 }
+
+reliq
+reliq_init_parallel(const char *ptr, const size_t size, const uint threads)
+{
+  return reliq_init_threads(ptr,size,threads,0);
+}
+
+reliq
+reliq_init_lazy(const char *ptr, const size_t size, const uint threads)
+{
+  return reliq_init_threads(ptr,size,threads,RELIQ_ATTRIBS_LAZY);
+}
+
+struct index_header {
+  char magic[8]; //INDEX_MAGIC
+  uint32_t version;
+  uint16_t nodesize; //index can be only read by builds with the same layout of nodes
+  uint16_t attribsize;
+  uint64_t size; //of data
+  uint64_t hash; //of data
+  uint64_t nodesl;
+  uint64_t attribsl;
+  uint64_t flags; //of reliq that was saved
+}; //followed by nodes and attribs
+
+static uint64_t
+index_hash(const char *ptr, const size_t size)
+{
+  //data is hashed in 4 lanes so that multiplications don't wait for each other
+  const uint64_t k = 0x9e3779b97f4a7c15;
+  uint64_t h[4] = {size,size^k,size+k,size*k};
+  size_t i = 0;
+  for (; i+32 <= size; i += 32) {
+    for (uint j = 0; j < 4; j++) {
+      uint64_t w;
+      memcpy(&w,ptr+i+j*8,8);
+      h[j] = (h[j]^w)*k;
+      h[j] ^= h[j]>>31;
+    }
+  }
+  uint64_t r = h[0]^(h[1]*3)^(h[2]*5)^(h[3]*7);
+  for (; i < size; i++)
+    r = (r^(uchar)ptr[i])*k;
+  return r^(r>>29);
+}
+
+reliq_error *
+reliq_save_index(const reliq *rq, FILE *output)
+{
+  struct index_header h;
+  memset(&h,0,sizeof(h));
+  memcpy(h.magic,INDEX_MAGIC,sizeof(h.magic));
+  h.version = INDEX_VERSION;
+  h.nodesize = sizeof(reliq_chnode);
+  h.attribsize = sizeof(reliq_span_pair);
+  h.size = rq->size;
+  h.hash = index_hash(rq->data,rq->size);
+  h.nodesl = rq->nodesl;
+  h.attribsl = (rq->flags&RELIQ_ATTRIBS_LAZY) ? 0 : rq->attribsl;
+  h.flags = rq->flags&RELIQ_ATTRIBS_LAZY;
+
+  if (fwrite(&h,sizeof(h),1,output) != 1
+    || fwrite(rq->nodes,sizeof(reliq_chnode),h.nodesl,output) != h.nodesl
+    || fwrite(rq->attribs,sizeof(reliq_span_pair),h.attribsl,output) != h.attribsl
+    || fflush(output) != 0)
+    return reliq_set_error(1,"index: could not be written");
+  return NULL;
+}
+
+static uchar
+index_span_valid(const reliq_span *span, const size_t size)
+{
+  //empty spans aren't read, parser leaves them past the end of tags cut by the end of data
+  return !span->s || (uint64_t)span->b+span->s <= size;
+}
+
+static uchar
+index_nodes_valid(const reliq *rq)
+{
+  //single pass checking that nothing in nodes leads outside of data, nodes or attribs
+  const reliq_chnode *nodes = rq->nodes;
+  const uchar lazy = (rq->flags&RELIQ_ATTRIBS_LAZY) != 0;
+  for (size_t i = 0; i < rq->nodesl; i++) {
+    const reliq_chnode *n = nodes+i;
+    if (!index_span_valid(&n->all,rq->size) || !index_span_valid(&n->tag,rq->size)
+      || !index_span_valid(&n->insides,rq->size))
+      return 0;
+    if (n->child_count >= rq->nodesl-i || n->parent > i || n->prev > i)
+      return 0;
+    if (n->parent) {
+      const reliq_chnode *parent = n-n->parent;
+      if (n->lvl != parent->lvl+1 || parent->child_count < n->parent)
+        return 0;
+    } else if (n->lvl != 0)
+      return 0;
+    if (n->prev && nodes[i-n->prev].lvl != n->lvl)
+      return 0;
+
+    if (lazy) {
+      if (n->attribsl || n->attribs > rq->size)
+        return 0;
+    } else if ((uint64_t)n->attribs+n->attribsl > rq->attribsl)
+      return 0;
+  }
+  for (size_t i = 0; i < rq->attribsl; i++)
+    if (!index_span_valid(&rq->attribs[i].f,rq->size) || !index_span_valid(&rq->attribs[i].s,rq->size))
+      return 0;
+  return 1;
+}
+
+reliq_error *
+reliq_load_index(const char *ptr, const size_t size, const char *idx, const size_t idxl, reliq *rq)
+{
+  //nodes and attribs aren't copied, idx has to be valid and aligned to 8 bytes for as long as rq is used
+  struct index_header h;
+  if (idxl < sizeof(h))
+    return reliq_set_error(1,"index: too small");
+  memcpy(&h,idx,sizeof(h));
+  if (memcmp(h.magic,INDEX_MAGIC,sizeof(h.magic)) != 0 || h.version != INDEX_VERSION
+    || h.nodesize != sizeof(reliq_chnode) || h.attribsize != sizeof(reliq_span_pair))
+    return reliq_set_error(1,"index: incompatible format");
+
+  size_t rest = idxl-sizeof(h);
+  if (h.nodesl > rest/sizeof(reliq_chnode))
+    return reliq_set_error(1,"index: truncated");
+  rest -= h.nodesl*sizeof(reliq_chnode);
+  if (h.attribsl != rest/sizeof(reliq_span_pair) || rest%sizeof(reliq_span_pair))
+    return reliq_set_error(1,"index: truncated");
+
+  if (h.size != size || h.hash != index_hash(ptr,size))
+    return reliq_set_error(1,"index: made for different data");
+
+  memset(rq,0,sizeof(reliq));
+  rq->data = ptr;
+  rq->size = size;
+  rq->flags = RELIQ_SAVE|RELIQ_INDEXED|(h.flags&RELIQ_ATTRIBS_LAZY);
+  rq->nodes = (reliq_chnode*)(idx+sizeof(h));
+  rq->nodesl = h.nodesl;
+  rq->attribs = (reliq_span_pair*)(idx+sizeof(h)+h.nodesl*sizeof(reliq_chnode));
+  rq->attribsl = h.attribsl;
+  if (!index_nodes_valid(rq)) {
+    memset(rq,0,sizeof(reliq));
+    return reliq_set_error(1,"index: corrupted");
+  }
+  rq->attrib_buffer = (rq->flags&RELIQ_ATTRIBS_LAZY) ? attribs_cache_init(rq->nodes,rq->nodesl) : NULL;
+  rq->postings = postings_init(rq->nodes,rq->nodesl);
+  return NULL;
+}
@@ -20,9 +20,29 @@
 #define RELIQ_H
 
 #define RELIQ_SAVE 0x1
+#define RELIQ_STREAM 0x2
+#define RELIQ_ATTRIBS_LAZY 0x4 //attribs of nodes are tokenized when they're first needed
+#define RELIQ_INDEXED 0x8 //nodes and attribs are in index given to reliq_load_index() and aren't freed
+
+//data of nodes that expression depends on
+#define RELIQ_NEEDS_ATTRIBS 0x1
+#define RELIQ_NEEDS_INSIDES 0x2
+#define RELIQ_NEEDS_CHILD_COUNT 0x4
+#define RELIQ_NEEDS_TEXT 0x8
+#define RELIQ_NEEDS_SIBLINGS 0x10
+
+#define RELIQ_HNODE_SELFCLOSING 0x1 //tag doesn't end with </tag>
+#define RELIQ_HNODE_SCRIPT 0x2 //insides of tag are ommited
+#define RELIQ_HNODE_AUTOCLOSING 0x4 //tag doesn't need to be closed
 
 #define RELIQ_ERROR_MESSAGE_LENGTH 512
 
+#define RELIQ_BUNDLE_MAGIC "reliqbdl" //beginning of expressions saved by reliq_esave()
+
+#define RELIQ_SIZE_MAX 0xffffffff //nodes store positions in data as 32 bit offsets
+
+#define RELIQ_NODE_NONE ((size_t)-1) //index of missing node, e.g. parent of node at the top
+
 typedef struct {
   void *arg[4];
   unsigned char flags;
@@ -53,15 +73,8 @@ typedef struct {
   int code;
 } reliq_error;
 
-typedef struct {
-  reliq_cstr all;
-  reliq_cstr tag;
-  reliq_cstr insides;
-  reliq_cstr_pair *attribs;
-  unsigned int child_count;
-  unsigned short attribsl;
-  unsigned short lvl;
-} reliq_hnode; //html node
+typedef struct reliq_chnode reliq_chnode; //html node, its fields are got with reliq_node_*()
+typedef struct reliq_span_pair reliq_span_pair; //attrib of reliq_chnode
 
 struct reliq_range_node {
   unsigned int v[4];
@@ -74,9 +87,16 @@ typedef struct {
 } reliq_range;
 
 typedef struct {
-  union {
-    reliq_str str;
-    regex_t reg;
+  regex_t reg;
+  struct dfa *dfa; //used instead of reg if pattern could be converted
+  reliq_str literal; //has to be found in every match, checked before matching
+  unsigned int refs; //number of patterns that use it
+} reliq_regex; //identical regexes in expressions are compiled once
+
+typedef struct {
+  struct {
+    reliq_str str; //source of pattern
+    reliq_regex *reg; //compiled pattern if it's a regex
   } match;
   reliq_range range;
   unsigned short flags;
@@ -110,12 +130,14 @@ typedef struct {
   size_t exprfl;
   #endif
   unsigned short childfields;
+  unsigned char needs; //RELIQ_NEEDS_* of its nodes and format
   unsigned char flags;
 } reliq_expr;
 
 typedef struct {
   reliq_expr *b;
   size_t s;
+  unsigned char needs; //RELIQ_NEEDS_* of all expressions
 } reliq_exprs;
 
 typedef struct {
@@ -138,23 +160,33 @@ struct reliq_node {
   reliq_node *node;
 
   size_t hooksl;
+  size_t hooksl_cheap; //hooks checked before attribs, hooks and attribs are sorted by cost of checking them
   size_t attribsl;
+  unsigned int lvl_max; //nodes at deeper levels can't be matched when parent is not given
+  unsigned short tag_id; //id of tag if it's matched literally, 0 otherwise
+  unsigned char needs; //RELIQ_NEEDS_* of it and nodes chained to it
   unsigned char flags;
 };
 
 typedef struct {
-  reliq_hnode *hnode;
-  reliq_hnode *parent;
+  reliq_chnode *hnode;
+  reliq_chnode *parent; //NULL if not given, reliq_node_index() gets indexes of both
 } reliq_compressed;
 
 typedef struct {
   char const *data;
-  reliq_hnode *nodes;
+  reliq_chnode *nodes;
+  reliq_span_pair *attribs; //attribs of all nodes, nodes have indexes to it
 
   FILE *output;
   reliq_node const *expr; //node passed to process at parsing
 
-  void *attrib_buffer; //used as temporary buffer for attribs
+  void *attrib_buffer; //used as temporary buffer for attribs, or their cache if they are lazy
+  void *sindex; //structural index of data used at parsing
+  void *parallel; //siblings parsed by other threads that can be used at parsing
+  void *postings; //lists of nodes having attribs, built when they're first needed
+  void *firsts; //matches of first nodes of expressions found in a single pass, set during execution
+  unsigned int threads; //used for matching nodes if set to more than 1, it's 0 after initialization
 
   #ifdef RELIQ_EDITING
   reliq_format_func *nodef;
@@ -164,29 +196,76 @@ typedef struct {
   size_t nodefl; //format used for output at parsing
 
   size_t nodesl;
-  size_t size; //length of data
+  size_t attribsl;
+  size_t size; //length of data, can't be bigger than RELIQ_SIZE_MAX
   unsigned char flags;
 } reliq;
 
+typedef struct {
+  reliq rq; //has to be first, parser gets it as reliq
+  void *nodes; //flexarr of nodes that are being parsed
+
+  char *buffer; //data of unfinished top level node
+  size_t bufferl;
+  size_t buffers; //allocated size of buffer
+  size_t offset; //position of buffer in the whole stream
+  size_t tried; //length of buffer at the last parsing of unfinished node
+
+  size_t written; //matched nodes of unfinished node that were already written
+  size_t matched; //matched nodes counted at the current parsing
+  unsigned char edge; //parsing of last top level node depended on the end of data
+  unsigned char end; //there will be no more data
+
+  const reliq_exprs *exprs;
+  FILE *destination;
+  char *chain_output; //output of first expression if chain has more of them
+  size_t chain_outputl;
+} reliq_stream;
+
 reliq reliq_init(const char *ptr, const size_t size);
+reliq reliq_init_parallel(const char *ptr, const size_t size, const unsigned int threads);
+reliq reliq_init_lazy(const char *ptr, const size_t size, const unsigned int threads);
+
+reliq_error *reliq_save_index(const reliq *rq, FILE *output);
+reliq_error *reliq_load_index(const char *ptr, const size_t size, const char *idx, const size_t idxl, reliq *rq);
 
 reliq_error *reliq_ncomp(const char *script, size_t size, reliq_node *node);
 reliq_error *reliq_ecomp(const char *script, size_t size, reliq_exprs *exprs);
+reliq_error *reliq_esave(const reliq_exprs *exprs, FILE *output);
+reliq_error *reliq_eload(const char *ptr, const size_t size, reliq_exprs *exprs);
 
 reliq reliq_from_compressed(const reliq_compressed *compressed, const size_t compressedl, const reliq *rq);
-reliq reliq_from_compressed_independent(const reliq_compressed *compressed, const size_t compressedl, char **ptr, size_t *size);
-
-int reliq_match(const reliq_hnode *hnode, const reliq_hnode *parent, const reliq_node *node);
+reliq reliq_from_compressed_independent(const reliq_compressed *compressed, const size_t compressedl, const reliq *rq, char **ptr, size_t *size);
+
+size_t reliq_node_count(const reliq *rq);
+size_t reliq_node_index(const reliq *rq, const reliq_chnode *hnode);
+reliq_cstr reliq_node_all(const reliq *rq, const size_t i);
+reliq_cstr reliq_node_tag(const reliq *rq, const size_t i);
+reliq_cstr reliq_node_insides(const reliq *rq, const size_t i);
+size_t reliq_node_attribsl(const reliq *rq, const size_t i);
+reliq_cstr_pair reliq_node_attrib(const reliq *rq, const size_t i, const size_t attrib);
+size_t reliq_node_child_count(const reliq *rq, const size_t i);
+size_t reliq_node_lvl(const reliq *rq, const size_t i);
+size_t reliq_node_parent(const reliq *rq, const size_t i);
+unsigned char reliq_node_tag_flags(const reliq *rq, const size_t i);
+
+int reliq_match(const reliq *rq, const size_t i, const size_t parent, const reliq_node *node);
 
 reliq_error *reliq_fexec_file(char *ptr, const size_t size, FILE *output, const reliq_exprs *exprs, int (*freeptr)(void *ptr, size_t size));
 reliq_error *reliq_fexec_str(char *ptr, const size_t size, char **str, size_t *strl, const reliq_exprs *exprs, int (*freeptr)(void *ptr, size_t size));
 
+reliq_error *reliq_stream_init(reliq_stream *stream, FILE *output, const reliq_exprs *exprs);
+reliq_error *reliq_stream_feed(reliq_stream *stream, const char *ptr, const size_t size);
+reliq_error *reliq_stream_finish(reliq_stream *stream);
+
 reliq_error *reliq_exec_file(reliq *rq, FILE *output, const reliq_exprs *exprs);
 reliq_error *reliq_exec_str(reliq *rq, char **str, size_t *strl, const reliq_exprs *exprs);
 reliq_error *reliq_exec(reliq *rq, reliq_compressed **nodes, size_t *nodesl, const reliq_exprs *exprs);
+reliq_error *reliq_exec_files(reliq *rq, FILE **outputs, const reliq_exprs *exprs, const size_t exprsl);
 
-void reliq_printf(FILE *outfile, const char *format, const size_t formatl, const reliq_hnode *hnode, const reliq_hnode *parent, const reliq *rq);
-void reliq_print(FILE *outfile, const reliq_hnode *hnode);
+void reliq_printf(FILE *outfile, const char *format, const size_t formatl, const size_t i, const size_t parent, const reliq *rq);
+void reliq_print(FILE *outfile, const size_t i, const reliq *rq);
+void reliq_print_order(const reliq_exprs *exprs, FILE *output);
 
 void reliq_nfree(reliq_node *node);
 void reliq_efree(reliq_exprs *expr);
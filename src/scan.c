@@ -0,0 +1,465 @@
+/*
+    reliq - html searching tool
+    Copyright (C) 2020-2024 Dominik Stanisław Suchora <suchora.dominik7@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+#define __USE_XOPEN
+#define __USE_XOPEN_EXTENDED
+#define _XOPEN_SOURCE 600
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+typedef unsigned char uchar;
+typedef unsigned short ushort;
+typedef unsigned int uint;
+typedef unsigned long int ulong;
+
+#include "ctype.h"
+#include "scan.h"
+
+#if defined(__AVX2__)
+static inline uint64_t
+sindex_block(const char *ptr, uint64_t *st)
+{
+  //returns bitmap of '<' in 64 bytes, and sets st to bitmap of SINDEX_CHARS unless it's NULL
+  uint64_t lt = 0,t = 0;
+  for (uint j = 0; j < 64; j += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(ptr+j));
+    lt |= (uint64_t)(uint)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v,_mm256_set1_epi8('<')))<<j;
+    if (!st)
+      continue;
+    __m256i m = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(v,_mm256_set1_epi8('>')),_mm256_cmpeq_epi8(v,_mm256_set1_epi8('='))),
+      _mm256_or_si256(_mm256_cmpeq_epi8(v,_mm256_set1_epi8('/')),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v,_mm256_set1_epi8('"')),_mm256_cmpeq_epi8(v,_mm256_set1_epi8('\'')))));
+    t |= (uint64_t)(uint)_mm256_movemask_epi8(m)<<j;
+  }
+  if (st)
+    *st = t;
+  return lt;
+}
+#elif defined(__SSE2__)
+static inline uint64_t
+sindex_block(const char *ptr, uint64_t *st)
+{
+  //returns bitmap of '<' in 64 bytes, and sets st to bitmap of SINDEX_CHARS unless it's NULL
+  uint64_t lt = 0,t = 0;
+  for (uint j = 0; j < 64; j += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(ptr+j));
+    lt |= (uint64_t)(uint)_mm_movemask_epi8(_mm_cmpeq_epi8(v,_mm_set1_epi8('<')))<<j;
+    if (!st)
+      continue;
+    __m128i m = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(v,_mm_set1_epi8('>')),_mm_cmpeq_epi8(v,_mm_set1_epi8('='))),
+      _mm_or_si128(_mm_cmpeq_epi8(v,_mm_set1_epi8('/')),
+        _mm_or_si128(_mm_cmpeq_epi8(v,_mm_set1_epi8('"')),_mm_cmpeq_epi8(v,_mm_set1_epi8('\'')))));
+    t |= (uint64_t)(uint)_mm_movemask_epi8(m)<<j;
+  }
+  if (st)
+    *st = t;
+  return lt;
+}
+#else
+static inline uint64_t
+sindex_block(const char *ptr, uint64_t *st)
+{
+  //returns bitmap of '<' in 64 bytes, and sets st to bitmap of SINDEX_CHARS unless it's NULL
+  uint64_t lt = 0,t = 0;
+  for (uint j = 0; j < 64; j++) {
+    if (ptr[j] == '<') {
+      lt |= (uint64_t)1<<j;
+    } else if (st && memchr(SINDEX_CHARS,ptr[j],sizeof(SINDEX_CHARS)-1))
+      t |= (uint64_t)1<<j;
+  }
+  if (st)
+    *st = t;
+  return lt;
+}
+#endif
+
+#if defined(__AVX2__)
+#define VEC_SIZE 32
+#define VEC_MASK 0xffffffffu //of all bytes
+typedef __m256i vec;
+
+static inline vec
+vec_load(const char *ptr)
+{
+  return _mm256_loadu_si256((const __m256i*)ptr);
+}
+
+static inline uint
+vec_eq(const vec v, const char c)
+{
+  return (uint)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v,_mm256_set1_epi8(c)));
+}
+
+static inline uint
+vec_space(const vec v)
+{
+  //same characters as isspace() from ctype.h, '\t' to '\r' are checked as one range
+  vec t = _mm256_sub_epi8(v,_mm256_set1_epi8('\t'));
+  return vec_eq(v,' ')|(uint)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(t,_mm256_set1_epi8(4)),t));
+}
+
+static inline uint
+vec_eqv(const vec v1, const vec v2)
+{
+  return (uint)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1,v2));
+}
+
+static inline vec
+vec_lower(const vec v)
+{
+  //same as tolower() from ctype.h, only 'A' to 'Z' are changed
+  vec t = _mm256_sub_epi8(v,_mm256_set1_epi8('A'));
+  vec upper = _mm256_cmpeq_epi8(_mm256_min_epu8(t,_mm256_set1_epi8(25)),t);
+  return _mm256_or_si256(v,_mm256_and_si256(upper,_mm256_set1_epi8(0x20)));
+}
+#elif defined(__SSE2__)
+#define VEC_SIZE 16
+#define VEC_MASK 0xffffu //of all bytes
+typedef __m128i vec;
+
+static inline vec
+vec_load(const char *ptr)
+{
+  return _mm_loadu_si128((const __m128i*)ptr);
+}
+
+static inline uint
+vec_eq(const vec v, const char c)
+{
+  return (uint)_mm_movemask_epi8(_mm_cmpeq_epi8(v,_mm_set1_epi8(c)));
+}
+
+static inline uint
+vec_space(const vec v)
+{
+  //same characters as isspace() from ctype.h, '\t' to '\r' are checked as one range
+  vec t = _mm_sub_epi8(v,_mm_set1_epi8('\t'));
+  return vec_eq(v,' ')|(uint)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(t,_mm_set1_epi8(4)),t));
+}
+
+static inline uint
+vec_eqv(const vec v1, const vec v2)
+{
+  return (uint)_mm_movemask_epi8(_mm_cmpeq_epi8(v1,v2));
+}
+
+static inline vec
+vec_lower(const vec v)
+{
+  //same as tolower() from ctype.h, only 'A' to 'Z' are changed
+  vec t = _mm_sub_epi8(v,_mm_set1_epi8('A'));
+  vec upper = _mm_cmpeq_epi8(_mm_min_epu8(t,_mm_set1_epi8(25)),t);
+  return _mm_or_si128(v,_mm_and_si128(upper,_mm_set1_epi8(0x20)));
+}
+#endif
+
+static inline uchar
+is_space(const char c)
+{
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+size_t
+scan_str(const char *ptr, size_t pos, const size_t size, const char *str, const size_t strl)
+{
+  //returns position of str in ptr starting from pos, or size if it's not there
+  if (!strl || pos >= size || size-pos < strl)
+    return size;
+  #ifdef VEC_SIZE
+  //candidates have to match on the first and the last character
+  const size_t last = strl-1;
+  for (; pos+last+VEC_SIZE <= size; pos += VEC_SIZE) {
+    uint m = vec_eq(vec_load(ptr+pos),str[0])&vec_eq(vec_load(ptr+pos+last),str[last]);
+    while (m) {
+      size_t p = pos+__builtin_ctz(m);
+      if (memcmp(ptr+p+1,str+1,last) == 0)
+        return p;
+      m &= m-1;
+    }
+  }
+  #endif
+  char const *r = memmem(ptr+pos,size-pos,str,strl);
+  return r ? (size_t)(r-ptr) : size;
+}
+
+int
+scan_casecmp(const char *s1, const char *s2, const size_t n)
+{
+  //compares like memcmp() ignoring case of ascii letters
+  size_t i = 0;
+  #ifdef VEC_SIZE
+  for (; i+VEC_SIZE <= n; i += VEC_SIZE) {
+    uint m = vec_eqv(vec_lower(vec_load(s1+i)),vec_lower(vec_load(s2+i)))^VEC_MASK;
+    if (m) {
+      i += __builtin_ctz(m);
+      return (char)(toupper(s1[i])-toupper(s2[i]));
+    }
+  }
+  #endif
+  for (; i < n; i++) {
+    char diff = toupper(s1[i])-toupper(s2[i]);
+    if (diff)
+      return diff;
+  }
+  return 0;
+}
+
+size_t
+scan_casestr(const char *ptr, size_t pos, const size_t size, const char *str, const size_t strl)
+{
+  //same as scan_str() but ignores case of ascii letters
+  if (!strl || pos >= size || size-pos < strl)
+    return size;
+  const size_t last = strl-1;
+  const char first = tolower(str[0]),
+    lastc = tolower(str[last]);
+  #ifdef VEC_SIZE
+  for (; pos+last+VEC_SIZE <= size; pos += VEC_SIZE) {
+    uint m = vec_eq(vec_lower(vec_load(ptr+pos)),first)&vec_eq(vec_lower(vec_load(ptr+pos+last)),lastc);
+    while (m) {
+      size_t p = pos+__builtin_ctz(m);
+      if (scan_casecmp(ptr+p+1,str+1,last) == 0)
+        return p;
+      m &= m-1;
+    }
+  }
+  #endif
+  for (; pos+last < size; pos++)
+    if (tolower(ptr[pos]) == first && scan_casecmp(ptr+pos+1,str+1,last) == 0)
+      return pos;
+  return size;
+}
+
+size_t
+scan_chars(const char *ptr, size_t pos, const size_t size, const char *chars, const uint charsl)
+{
+  //returns position of the first of up to 4 chars starting from pos, or size if there is none
+  #ifdef VEC_SIZE
+  for (; pos+VEC_SIZE <= size; pos += VEC_SIZE) {
+    vec v = vec_load(ptr+pos);
+    uint m = 0;
+    for (uint j = 0; j < charsl; j++)
+      m |= vec_eq(v,chars[j]);
+    if (m)
+      return pos+__builtin_ctz(m);
+  }
+  #endif
+  for (; pos < size; pos++)
+    if (memchr(chars,ptr[pos],charsl))
+      return pos;
+  return size;
+}
+
+static size_t
+endtag_chain(const char *ptr, const size_t start, size_t pos)
+{
+  //'<' that doesn't start an end tag skips the first character after whitespace that follows it,
+  //so it has to be parsed from the first '<' of such sequence before pos
+  while (1) {
+    size_t j = pos;
+    while (j > start && is_space(ptr[j-1]))
+      j--;
+    if (j <= start || ptr[j-1] != '<')
+      return pos;
+    pos = j-1;
+  }
+}
+
+size_t
+scan_endtag(const char *ptr, const size_t pos, const size_t size)
+{
+  //returns position from which parser will reach the next end tag in script, skipping '<' that can't start it, or size if there is none
+  size_t i = pos;
+  #ifdef VEC_SIZE
+  for (; i+1+VEC_SIZE <= size; i += VEC_SIZE) {
+    vec next = vec_load(ptr+i+1);
+    uint m = vec_eq(vec_load(ptr+i),'<')&(vec_eq(next,'/')|vec_space(next));
+    if (m)
+      return endtag_chain(ptr,pos,i+__builtin_ctz(m));
+  }
+  #endif
+  for (; i < size; i++)
+    if (ptr[i] == '<' && (i+1 == size || ptr[i+1] == '/' || is_space(ptr[i+1])))
+      return endtag_chain(ptr,pos,i);
+  return size;
+}
+
+void
+sindex_build(struct sindex *index, const char *ptr, const size_t size)
+{
+  memset(index,0,sizeof(struct sindex));
+  if (!size)
+    return;
+
+  size_t s = (size+63)>>6;
+  index->lt = malloc(s*sizeof(uint64_t));
+  if (!index->lt)
+    return;
+  index->s = s;
+
+  size_t i=0,w=0;
+  for (; i+64 <= size; i += 64, w++) {
+    index->lt[w] = sindex_block(ptr+i,NULL);
+    index->count += __builtin_popcountll(index->lt[w]);
+  }
+  if (i == size)
+    return;
+
+  char last[64] = {0};
+  memcpy(last,ptr+i,size-i);
+  index->lt[w] = sindex_block(last,NULL);
+  index->count += __builtin_popcountll(index->lt[w]);
+}
+
+size_t
+sindex_next(struct sindex *index, const char *ptr, const size_t pos, const size_t size, const char c)
+{
+  if (pos >= size)
+    return size;
+  if (!index || !index->s || c != '<') {
+    char const *r = memchr(ptr+pos,c,size-pos);
+    return r ? (size_t)(r-ptr) : size;
+  }
+
+  size_t w = pos>>6;
+  uint64_t bits = index->lt[w]&(~(uint64_t)0<<(pos&63));
+  while (!bits) {
+    if (++w >= index->s)
+      return size;
+    bits = index->lt[w];
+  }
+  size_t p = (w<<6)+__builtin_ctzll(bits);
+  return (p < size) ? p : size;
+}
+
+struct tag_block {
+  size_t b; //position of block
+  uint64_t st; //bitmap of SINDEX_CHARS in 64 bytes from b
+};
+
+static inline size_t
+tag_block_next(const char *ptr, const size_t size, struct tag_block *block, size_t pos)
+{
+  //returns position of the first of SINDEX_CHARS from pos, bitmap of the next 64 bytes is made when pos leaves the block,
+  //tags are short so it isn't kept in sindex for the whole data
+  while (pos < size) {
+    if (pos < block->b || pos >= block->b+64) {
+      block->b = pos;
+      if (pos+64 <= size) {
+        sindex_block(ptr+pos,&block->st);
+      } else {
+        char last[64] = {0};
+        memcpy(last,ptr+pos,size-pos);
+        sindex_block(last,&block->st);
+      }
+    }
+    uint64_t bits = block->st>>(pos-block->b);
+    if (bits)
+      return pos+__builtin_ctzll(bits);
+    pos = block->b+64;
+  }
+  return size;
+}
+
+size_t
+scan_attribs(const char *ptr, size_t pos, const size_t size, uchar *slash)
+{
+  //returns position that html_attribs_handle() reaches without attribs and sets slash to what it returns,
+  //'/' and '>' end tag unless they're in values, which begin with '=' following name
+  struct tag_block block = {size,0};
+  *slash = 0;
+  size_t start = pos; //names can't begin before it
+  while (1) {
+    //quotes outside of values are skipped like other characters
+    size_t p = pos;
+    while ((p = tag_block_next(ptr,size,&block,p)) < size && (ptr[p] == '"' || ptr[p] == '\''))
+      p++;
+    if (p >= size)
+      return size;
+    if (ptr[p] != '=') {
+      *slash = (ptr[p] == '/');
+      return p;
+    }
+    pos = p+1;
+
+    //characters before name are skipped, so name before '=' has to have a letter
+    while (p > start && is_space(ptr[p-1]))
+      p--;
+    while (p > start && !isalpha(ptr[p-1]) && (isalnum(ptr[p-1]) || ptr[p-1] == '-' || ptr[p-1] == '_' || ptr[p-1] == ':'))
+      p--;
+    if (p == start || !isalpha(ptr[p-1]))
+      continue;
+
+    while (pos < size && is_space(ptr[pos]))
+      pos++;
+    if (pos >= size)
+      return size;
+    char c = ptr[pos];
+    if (c == '>') {
+      pos++;
+    } else if (c == '"' || c == '\'') {
+      while ((pos = tag_block_next(ptr,size,&block,pos+1)) < size && ptr[pos] != c)
+        ;
+      if (pos >= size)
+        return size;
+      pos++;
+    } else
+      while (pos < size && !is_space(ptr[pos]) && ptr[pos] != '>')
+        pos++;
+    start = pos;
+  }
+}
+
+size_t
+sindex_count(struct sindex *index, const size_t start, const size_t end)
+{
+  if (!index || !index->s || start >= end)
+    return 0;
+  size_t w = start>>6,last = (end-1)>>6;
+  if (last >= index->s)
+    last = index->s-1;
+  size_t count = 0;
+  for (size_t j = w; j <= last; j++) {
+    uint64_t bits = index->lt[j];
+    if (j == w)
+      bits &= ~(uint64_t)0<<(start&63);
+    if (j == (end-1)>>6 && (end&63))
+      bits &= ~(~(uint64_t)0<<(end&63));
+    count += __builtin_popcountll(bits);
+  }
+  return count;
+}
+
+void
+sindex_free(struct sindex *index)
+{
+  if (index->lt)
+    free(index->lt);
+  memset(index,0,sizeof(struct sindex));
+}
@@ -0,0 +1,44 @@
+/*
+    reliq - html searching tool
+    Copyright (C) 2020-2024 Dominik Stanisław Suchora <suchora.dominik7@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdint.h>
+
+#define SINDEX_CHARS ">=/\"'" //characters that separate parts of tags
+
+struct sindex {
+  uint64_t *lt; //bitmap of '<'
+  size_t s; //number of words in bitmap
+  size_t count; //number of '<'
+};
+
+void sindex_build(struct sindex *index, const char *ptr, const size_t size);
+size_t sindex_next(struct sindex *index, const char *ptr, const size_t pos, const size_t size, const char c);
+size_t sindex_count(struct sindex *index, const size_t start, const size_t end);
+void sindex_free(struct sindex *index);
+
+size_t scan_str(const char *ptr, size_t pos, const size_t size, const char *str, const size_t strl);
+size_t scan_casestr(const char *ptr, size_t pos, const size_t size, const char *str, const size_t strl);
+int scan_casecmp(const char *s1, const char *s2, const size_t n);
+size_t scan_chars(const char *ptr, size_t pos, const size_t size, const char *chars, const unsigned int charsl);
+size_t scan_endtag(const char *ptr, const size_t pos, const size_t size);
+size_t scan_attribs(const char *ptr, size_t pos, const size_t size, unsigned char *slash);
+
+#endif
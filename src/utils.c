@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <regex.h>
+#include <stdint.h>
 
 typedef unsigned char uchar;
 typedef unsigned short ushort;
@@ -35,6 +36,7 @@ typedef unsigned long int ulong;
 #include "flexarr.h"
 #include "ctype.h"
 #include "utils.h"
+#include "scan.h"
 
 #define RANGES_INC (1<<4)
 
@@ -143,33 +145,16 @@ memdup(void const *src, size_t size)
 int
 memcasecmp(const void *v1, const void *v2, const size_t n)
 {
-  const char *s1 = v1,
-    *s2 = v2;
-  for (size_t i = 0; i < n; i++) {
-    char u1 = toupper(s1[i]);
-    char u2 = toupper(s2[i]);
-    char diff = u1-u2;
-    if (diff)
-      return diff;
-  }
-  return 0;
+  return scan_casecmp(v1,v2,n);
 }
 
 void const*
 memcasemem(void const *haystack, size_t const haystackl, const void *needle, const size_t needlel)
 {
-  if (haystackl < needlel || !haystackl || !needlel)
+  size_t r = scan_casestr(haystack,0,haystackl,needle,needlel);
+  if (r == haystackl)
     return NULL;
-  const char *haystack_s = haystack,
-    *needle_s = needle;
-  for (size_t i=0,prev; i < haystackl; i++) {
-    prev = i;
-    for (size_t j=0; i < haystackl && j < needlel && toupper(needle_s[j]) == toupper(haystack_s[i]); i++, j++)
-      if (j == needlel-1)
-        return haystack+(i-j);
-    i = prev;
-  }
-  return NULL;
+  return haystack+r;
 }
 
 char
@@ -302,6 +287,24 @@ range_match(const uint matched, const reliq_range *range, const size_t last)
   return r->flags&R_INVERT ? 1 : 0;
 }
 
+uint
+range_max(const reliq_range *range)
+{
+  //returns the biggest value that range_match() can match without last, or -1 if there is no limit
+  if (!range || !range->s)
+    return -1;
+  uint max = 0;
+  for (size_t i = 0; i < range->s; i++) {
+    struct reliq_range_node const *r = &range->b[i];
+    if (r->flags&(R_INVERT|3)) //values counted from the end have no limit
+      return -1;
+    uint x = (r->flags&R_RANGE) ? r->v[1] : r->v[0];
+    if (x > max)
+      max = x;
+  }
+  return max;
+}
+
 static reliq_error *
 range_node_comp(const char *src, const size_t size, struct reliq_range_node *node)
 {
@@ -407,3 +410,95 @@ range_free(reliq_range *range)
   if (range->s)
     free(range->b);
 }
+
+void
+save_str(const char *src, const size_t size, FILE *output)
+{
+  uint64_t s = size;
+  fwrite(&s,sizeof(s),1,output);
+  fwrite(src,1,size,output);
+}
+
+int
+load_bytes(void *dest, const size_t len, const char *ptr, const size_t size, size_t *pos)
+{
+  if (len > size-*pos)
+    return -1;
+  memcpy(dest,ptr+*pos,len);
+  *pos += len;
+  return 0;
+}
+
+int
+load_count(size_t *count, const size_t elsize, const char *ptr, const size_t size, size_t *pos)
+{
+  //count of elements that take at least elsize bytes each
+  uint64_t c;
+  if (load_bytes(&c,sizeof(c),ptr,size,pos) || c > (size-*pos)/elsize)
+    return -1;
+  *count = c;
+  return 0;
+}
+
+int
+load_str(reliq_str *str, const char *ptr, const size_t size, size_t *pos)
+{
+  str->b = NULL;
+  str->s = 0;
+  if (load_count(&str->s,1,ptr,size,pos))
+    return -1;
+  if (str->s)
+    str->b = memdup(ptr+*pos,str->s);
+  *pos += str->s;
+  return 0;
+}
+
+void
+range_print(const reliq_range *range, FILE *output)
+{
+  //prints range in syntax that it's compiled from
+  fputc('[',output);
+  for (size_t i = 0; i < range->s; i++) {
+    struct reliq_range_node const *r = &range->b[i];
+    if (i)
+      fputc(',',output);
+    if (r->flags&R_INVERT)
+      fputc('!',output);
+    fprintf(output,(r->flags&1) ? "-%u" : "%u",r->v[0]);
+    if (!(r->flags&R_RANGE))
+      continue;
+    fputc(':',output);
+    if (!(r->flags&2)) {
+      fprintf(output,"%u",r->v[1]);
+    } else if (r->v[1]) //empty end is the last value
+      fprintf(output,"-%u",r->v[1]);
+    if (r->v[2] || r->v[3])
+      fprintf(output,":%u",r->v[2]);
+    if (r->v[3])
+      fprintf(output,":%u",r->v[3]);
+  }
+  fputc(']',output);
+}
+
+void
+range_save(const reliq_range *range, FILE *output)
+{
+  save_str((const char*)range->b,range->s*sizeof(struct reliq_range_node),output);
+}
+
+int
+range_load(reliq_range *range, const char *ptr, const size_t size, size_t *pos)
+{
+  reliq_str str;
+  range->s = 0;
+  if (load_str(&str,ptr,size,pos))
+    return -1;
+  range->b = (struct reliq_range_node*)str.b;
+  range->s = str.s/sizeof(struct reliq_range_node);
+  if (str.s%sizeof(struct reliq_range_node)) {
+    free(str.b);
+    range->s = 0;
+    return -1;
+  }
+  return 0;
+}
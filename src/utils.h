@@ -47,6 +47,14 @@ reliq_error *get_quoted(char *src, size_t *i, size_t *size, const char delim, si
 void conv_special_characters(char *src, size_t *size);
 reliq_error *range_comp(const char *src, size_t *pos, const size_t size, reliq_range *range);
 unsigned char range_match(const uint matched, const reliq_range *range, const size_t last);
+unsigned int range_max(const reliq_range *range);
 void range_free(reliq_range *range);
+void save_str(const char *src, const size_t size, FILE *output);
+int load_bytes(void *dest, const size_t len, const char *ptr, const size_t size, size_t *pos);
+int load_count(size_t *count, const size_t elsize, const char *ptr, const size_t size, size_t *pos);
+int load_str(reliq_str *str, const char *ptr, const size_t size, size_t *pos);
+void range_print(const reliq_range *range, FILE *output);
+void range_save(const reliq_range *range, FILE *output);
+int range_load(reliq_range *range, const char *ptr, const size_t size, size_t *pos);
 
 #endif
@@ -1,12 +1,42 @@
 #!/bin/sh
 
-[ "$3" = "update" ] && output="$(mktemp)"
+[ "$3" = "update" -o "$4" = "update" ] && output="$(mktemp)"
+[ "$3" = "bundle" ] && bundle="$(mktemp)" #expressions are compiled to bundle and loaded from it
+[ "$3" = "threads" -o "$4" = "threads" ] && threads="-j 4 "
+[ "$3" = "queries" ] && queries="$(mktemp -d)" #expressions of line are searched at once, each with its own -f and -o
+
+queries_run() {
+    #outputs are written one after another, with a note if any differs from separate search
+    file="$1"
+    shift
+    args=""
+    j=0
+    for e in "$@"
+    do
+        j=$((j+1))
+        printf "%s" "$e" > "$queries/$j"
+        args="$args -f $queries/$j -o $queries/$j.out"
+    done
+    ./reliq $threads$args "$file"
+    j=0
+    for e in "$@"
+    do
+        j=$((j+1))
+        cat "$queries/$j.out"
+        ./reliq "$e" "$file" | cmp -s - "$queries/$j.out" || echo "$e - differs from separate search"
+    done
+}
 
 sed 's/\\/\\\\/g' "$1" | while read i
 do
-    h="$(echo "$i" | cut -b 1-32)"
-    f="$(echo "$i" | cut -b 34-)"
-    c="./reliq $f $2"
+    h="$(printf "%s\n" "$i" | cut -b 1-32)"
+    f="$(printf "%s\n" "$i" | cut -b 34-)"
+    case "$f" in
+        "|"*) c="cat $2 | ./reliq ${f#|}";; #data is read through a pipe
+        *) c="./reliq $threads$f $2";;
+    esac
+    [ -n "$bundle" ] && c="./reliq -c $bundle $f && ./reliq -f $bundle $2"
+    [ -n "$queries" ] && c="queries_run $2 $f"
     n="$(eval "$c" | md5sum | cut -d ' ' -f1)"
     if [ -n "$output" ]
     then
@@ -17,4 +47,6 @@ do
 done
 
 [ -n "$output" ] && mv -f "$output" "$1"
+[ -n "$bundle" ] && rm -f "$bundle"
+[ -n "$queries" ] && rm -rf "$queries"
 exit 0